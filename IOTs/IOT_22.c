@@ -232,7 +232,7 @@ char wbuf[8];
             return(1);
         }
 
-        enablePolling(20);              // every 20 cycles, 100us
+        pollOnFd(epoll_fd);             // poll only when a channel has an event
 
         for( i = 0; i < NUM_CHANS; ++i )
         {
@@ -915,7 +915,7 @@ struct epoll_event event;
         break;
 
     case SCBRESET:
-        enablePolling(0);
+        pollOnFd(-1);
         iotLog("DCS full reset\n");
 
         for( i = 0; i < NUM_CHANS; ++i )
@@ -0,0 +1 @@
+Type23Drum/IOT_61.c
\ No newline at end of file
@@ -1,5 +1,11 @@
 #include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "common.h"
 #include "pdp1.h"
@@ -16,14 +22,30 @@
 
 /*
  * This is an implementation of the PDP-1 Type 23 Parallel Drum.
- * It keeps the drum data in a file named 'pdp23drum'.
+ * It keeps the drum data in a file named 'pdp23drum', mapped into memory when first started and until the
+ * IOT is unloaded, so transfers copy straight between the file's pages and core. The pages are written back
+ * to the file by a worker DRUMSYNC seconds after a write (environment variable PIDP1_DRUMSYNC overrides it,
+ * 0 for not) and when the -1 halts.
+ * The image is used as it is, fields past its end read as zeros and writes to them are lost.
+ * A new image is made full size, a read-only one is used but never written.
  * The drum also uses IOTs 62 and 63, so replicate into those.
  */
 
 #define DRUMFILE "/opt/pidp1/pdp23drum"
-#define DRUMADDRTOSEEK(field, offset) (((field * 4096) + (offset)) * sizeof(Word))
-
-static int drumFd = -1;
+#define DRUMFIELDS 32
+#define FIELDSIZE (4096 * sizeof(Word))
+#define DRUMSYNC 5
+
+static Word *drumP;             // the mapped drum file
+static int drumFields;          // how many the image has
+static size_t drumSize;
+static int drumShared;          // writes go to the file
+static Word zeroTrack[4096];    // for fields the image doesn't have
+static Word lostTrack[4096];
+static int drumDirty;           // written since the last sync was started
+static int syncRunning;         // a worker is syncing
+static u64 syncInterval;
+static u64 syncTime;            // when to sync if dirty
 static int drumReadField;
 static int drumWriteField;
 static int drumAddr;
@@ -34,18 +56,27 @@ static int writeMode;
 static int ioBusy;
 static int needBreak;
 static int inWait;
-static u64 lastSimtime;         // used in the polling code for drumcount updates
+static int drumTurning;         // the drum starts when first used
+static u64 drumBaseTime;        // simtime when the drum count was drumBaseCount
+static int drumBaseCount;
 static u64 cmdCompletionTime;   // relative to pdp1P->simtime
+static u64 breakTime;           // when the drum count reaches drumAddr for dba
 
 static int memBank;
 static int memAddr;
-static Word readBuffer[4096];
-static Word writeBuffer[4096];
+static Word readBuffer[4096];  // for a read and write of the same field, what was on the drum
 
 static int sbsChan = 5;
 
-static void readDrumToBuffer(int, Word *, int, int, int);
-static void writeBufferToDrum(int, Word *, int, int, int);
+static void mapDrum(void);
+static void unmapDrum(void) __attribute__((destructor));
+static Word *drumTrack(int, int);
+static void transferDrum(PDP1 *, int);
+static void syncDrum(void *);
+static void syncDone(PDP1 *, void *);
+static int drumPosition(PDP1 *);
+static u64 drumTimeOf(PDP1 *, int);
+static void schedulePoll(void);
 
 int
 iotHandler(PDP1 *pdp1P, int dev, int pulse, int completion)
@@ -61,14 +92,19 @@ Word *memBaseP;
 
     iotLog("In iot 61 as %o\n", dev);
 
-    if( drumFd < 0 )
+    if( !drumP )
     {
-        iotLog("In iot 61, no drumFd\n");
+        iotLog("In iot 61, no drum\n");
         return(0);                 // sorry, some error with the drum file
     }
 
-    lastSimtime = pdp1P->simtime;
-    enablePolling(1);
+    if( !drumTurning )
+    {
+        drumTurning = 1;
+        drumBaseTime = pdp1P->simtime;
+        drumBaseCount = 0;      // we don't really know where the hardware would have been, just use 0
+    }
+
     inWait = completion;            // if nonzero, we will be in IOT wait state
 
     switch( dev )
@@ -93,8 +129,11 @@ Word *memBaseP;
             // dba, using the interrupt system. reqiest break
             // The break happens when the drumCount == the drumAddr
             needBreak = 1;
+            breakTime = drumTimeOf(pdp1P, drumAddr);
             iotLog("dba, break on %o\n", drumAddr);
         }
+
+        schedulePoll();
         
         iotLog("dia done, read %d, rfield %d, daddr %d\n", readMode, drumReadField, drumAddr);
         break;
@@ -103,8 +142,8 @@ Word *memBaseP;
         if( pdp1P->mb & 02000 )
         {
             // dra, return current drum 'counter' in the IO register, along with status
-            pdp1P->io = drumCount;
-            iotLog("dra drum count %o\n", drumCount);
+            pdp1P->io = drumPosition(pdp1P);
+            iotLog("dra drum count %o\n", pdp1P->io);
         }
         else
         {
@@ -167,28 +206,33 @@ Word *memBaseP;
         if( readMode )
         {
             chanFlags |= HSC_MODE_TOMEM;
-            readDrumToBuffer(drumFd, readBuffer, drumReadField, drumAddr, transferCount);
-            iotLog("dcl 63 read drum to rbuffer\n");
+            iotLog("dcl 63 read drum\n");
         }
 
         if( writeMode )
         {
             chanFlags |= HSC_MODE_FROMMEM;
-            iotLog("dcl 63 requesting write\n");
+            drumDirty = 1;
+            iotLog("dcl 63 write drum\n");
         }
 
+        transferDrum(pdp1P, chanFlags);
+
         pdp1P->cksflags |= CKS_DRP;
 
         // Transferring a full mem bank is special, it can start anywhere, no rotational delay
+        cmdCompletionTime = 0;
         if( transferCount != 4096 )
         {
+            drumCount = drumPosition(pdp1P);
+
             if( drumAddr < drumCount )  // have to wait for it to come around again on the guitar
             {
                 cmdCompletionTime = 4096 - drumCount + drumAddr;
             }
             else
             {
-                cmdCompletionTime = drumCount - drumAddr;
+                cmdCompletionTime = drumAddr - drumCount;
             }
         }
 
@@ -197,11 +241,9 @@ Word *memBaseP;
         // Each drum word takes 8.5us, plus the rotation time to get to the word.
         cmdCompletionTime = pdp1P->simtime + (cmdCompletionTime * 8500);
 
-        // we assume we get it, manual says to check status before calling IOT_61.
         pdp1P->hsc = 1;                     // and we have to manage the light
-        stat = HSC_request_channel(pdp1P, 1, chanFlags, transferCount, memBank, memAddr, readBuffer, writeBuffer);
-        iotLog("HSC_request_channel returned %d\n", stat);
         ioBusy = 1;
+        schedulePoll();             // we're called again when it's done
         break;
 
     default:
@@ -214,53 +256,61 @@ Word *memBaseP;
 void
 iotStart()
 {
+char *envP;
+
     iotLog("IOT 61 started\n");
-    if( drumFd < 0 )
+    if( !drumP )
     {
-        drumFd = open(DRUMFILE, O_RDWR + O_CREAT + O_SYNC, 0666);
-        iotLog("IOT 61 drumFd = %d\n", drumFd);
+        mapDrum();
     }
 
+    syncInterval = (envP = getenv("PIDP1_DRUMSYNC")) ? atoi(envP) : DRUMSYNC;
+    syncInterval *= 1000000000;
+
     needBreak = 0;
-    drumCount = 0;  // we don't really know where the hardware would have been, just use 0
+    drumTurning = 0;
 }
 
+// The mapping stays, a halt only gets what was written to the file.
 void
 iotStop()
 {
     iotCloseLog();
 
-    if( drumFd >= 0 )
+    if( drumP && drumShared && drumDirty )
     {
-        close(drumFd);
-        drumFd = -1;
+        msync(drumP, drumSize, MS_SYNC);
+        drumDirty = 0;
+        syncTime = 0;
     }
 }
 
-// Used to update drumCount, trigger a break,  determine the end of a transfer
+// Called when a transfer is done or the drum has come around to the dba address, see schedulePoll().
+// The transfer itself happened in dcl, this ends it after the time the drum would have taken.
 void
 iotPoll(PDP1 *pdp1P)
 {
-int hsStatus;
-
     if( ioBusy )
     {
-        hsStatus = HSC_get_status(1);
-
-        if( (pdp1P->simtime >= cmdCompletionTime) && (hsStatus != HSC_BUSY) )
+        if( pdp1P->simtime >= cmdCompletionTime )
         {
-            iotLog("iotPoll completing, status %d\n", hsStatus);
+            iotLog("iotPoll completing\n");
             ioBusy = 0;
 
-            // We now have original memory contents in writeBuffer, update drum
-            if( writeMode )
+            if( writeMode && drumShared && syncInterval && !syncTime )
             {
-                iotLog("iotPoll writing writebuf to drum\n");
-                writeBufferToDrum(drumFd, writeBuffer, drumWriteField, drumAddr, transferCount);
+                syncTime = pdp1P->simtime + syncInterval;
             }
 
             pdp1P->cksflags &= ~CKS_DRP;    // and not busy
-            drumCount = (drumAddr + transferCount) % 4096;   // sync up the drum count to match the end of the transfer
+
+            // sync up the drum count to match the end of the transfer
+            drumBaseTime = pdp1P->simtime;
+            drumBaseCount = (drumAddr + transferCount) % 4096;
+            if( needBreak )
+            {
+                breakTime = drumTimeOf(pdp1P, drumAddr);
+            }
 
             if( inWait )
             {
@@ -272,90 +322,183 @@ int hsStatus;
             iotLog("IOT 61 completed timeout.\n");
         }
     }
-    else
+    else if( needBreak && (pdp1P->simtime >= breakTime) )
     {
-        // The original hardware updated this every 8.5us, be we aren't called with that timing.
-        // So the count is updated when simtime % 8500 is zero.
-        // This won't be exact, but the longer the time but the higher the count, the more accurate it will be.
-        // The worst case will be a 10us interval.
-
-        if( pdp1P->simtime >= (lastSimtime + 8500) )
-        {
-            lastSimtime = pdp1P->simtime;
-            drumCount = ++drumCount % 4096;
-        }
+        ioBusy = needBreak = 0;
+        pdp1P->cksflags &= ~CKS_DRP;    // and not busy
+        initiateBreak(5);               // the DEC drum diagnostic seems to use channel 5
+        iotLog("IOT 61 break initiated at drum count %o.\n", drumPosition(pdp1P));
+    }
 
-        if( needBreak && (drumCount == drumAddr) )
+    // write the drum back to the file now and then, without holding up the -1
+    if( syncTime && (pdp1P->simtime >= syncTime) && !syncRunning )
+    {
+        syncTime = 0;
+        if( drumDirty )
         {
-            ioBusy = needBreak = 0;
-            pdp1P->cksflags &= ~CKS_DRP;    // and not busy
-            initiateBreak(5);               // the DEC drum diagnostic seems to use channel 5
-            iotLog("IOT 61 break initiated at drum count %o.\n", drumCount);
+            drumDirty = 0;
+            syncRunning = 1;
+            if( submitJob(syncDrum, syncDone, 0, 0) < 0 )
+            {
+                syncDrum(0);
+                syncRunning = 0;
+            }
         }
     }
+
+    schedulePoll();
 }
 
-// Do a drum read handling drum wraparound
+// The drum count advances every 8.5us, so it's worked out from simtime when needed rather than counted.
+static int
+drumPosition(PDP1 *pdp1P)
+{
+    return( (drumBaseCount + (pdp1P->simtime - drumBaseTime) / 8500) % 4096 );
+}
+
+// simtime when the drum count is next at addr, now if it is there
+static u64
+drumTimeOf(PDP1 *pdp1P, int addr)
+{
+u64 words;
+
+    words = (pdp1P->simtime - drumBaseTime) / 8500;
+    words += (addr - (int)((drumBaseCount + words) % 4096)) & 07777;
+    return( drumBaseTime + (words * 8500) );
+}
+
+// Ask to be polled for whatever comes next, nothing at all while the drum is idle
 static void
-readDrumToBuffer(
-    int drumFd,         // file descriptor for our 'drum'
-    Word *buffer,       // must be at least 4096, anything over is unused
-    int drumField,      // which 4K block on drum
-    int drumAddr,       // start point relative to drum index
-    int transferCount)  // number of words to transfer
+schedulePoll(void)
 {
-int wantbytes;
-int gotbytes;
-int drumSplitCount = 0;
-int drumRemainderCount = 0;
+u64 when;
 
-    if( (drumAddr + transferCount) > 4095 )
+    if( ioBusy )
     {
-        drumSplitCount = 4096 - drumAddr;   // we transfer this many before wraparound
-        drumRemainderCount = transferCount - drumSplitCount;
+        when = cmdCompletionTime;
+    }
+    else if( needBreak )
+    {
+        when = breakTime;
     }
     else
     {
-        drumSplitCount = transferCount;
-        drumRemainderCount = 0;
+        when = NEVER;
     }
 
-    iotLog("read drum to buffer, drumSplitCount %d, drumRemainderCount %d\n", drumSplitCount, drumRemainderCount);
+    if( syncTime && (syncTime < when) )
+    {
+        when = syncTime;
+    }
+
+    pollAt(when);
+}
 
-    lseek(drumFd, DRUMADDRTOSEEK(drumField, drumAddr), SEEK_SET);
-    // a read fail is ok, could be an uninitialized drum block. Mem gets buffer content.
-    // But, the rest of the buffer is set to 0.
-    wantbytes = sizeof(Word) * drumSplitCount;
-    gotbytes = read(drumFd, buffer, wantbytes);
-    if( gotbytes != wantbytes )
+// on a worker
+static void
+syncDrum(void *argP)
+{
+    msync(drumP, drumSize, MS_SYNC);
+}
+
+static void
+mapDrum(void)
+{
+struct stat st;
+int fd;
+
+    drumShared = 1;
+    if( (fd = open(DRUMFILE, O_RDWR)) < 0 )
     {
-        memset(buffer + (gotbytes / sizeof(Word)), 0, wantbytes - gotbytes);
+        if( (errno == ENOENT) && ((fd = open(DRUMFILE, O_RDWR + O_CREAT, 0666)) >= 0) )
+        {
+            ftruncate(fd, DRUMFIELDS * FIELDSIZE);      // a new drum, all of it
+        }
+        else if( (fd = open(DRUMFILE, O_RDONLY)) >= 0 )
+        {
+            fprintf(stderr, "IOT 61: %s is read-only, drum writes won't be saved\n", DRUMFILE);
+            drumShared = 0;
+        }
+        else
+        {
+            return;
+        }
     }
 
-    if( drumRemainderCount )
+    if( fstat(fd, &st) < 0 )
+    {
+        close(fd);
+        return;
+    }
+
+    drumFields = st.st_size / FIELDSIZE;
+    if( drumFields > DRUMFIELDS )
     {
-        wantbytes = sizeof(Word) * drumRemainderCount;
-        lseek(drumFd, DRUMADDRTOSEEK(drumField, 0), SEEK_SET);
-        gotbytes = read(drumFd, buffer + drumSplitCount, wantbytes);
+        drumFields = DRUMFIELDS;
+    }
+
+    if( (st.st_size != (off_t)(drumFields * FIELDSIZE)) || (drumFields < DRUMFIELDS) )
+    {
+        fprintf(stderr, "IOT 61: %s is %ld bytes, using %d of %d fields\n", DRUMFILE, (long)st.st_size,
+            drumFields, DRUMFIELDS);
+    }
+
+    drumSize = drumFields * FIELDSIZE;
+    if( drumFields )
+    {
+        // a private mapping of a read-only image can still be written, only not saved
+        drumP = mmap(0, drumSize, PROT_READ|PROT_WRITE, drumShared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+        if( drumP == MAP_FAILED )
+        {
+            drumP = 0;
+        }
+    }
+    close(fd);
+    iotLog("IOT 61 mapped %d fields at %p\n", drumFields, drumP);
+}
 
-        if( gotbytes != wantbytes )
+// when unloaded or at exit
+static void
+unmapDrum(void)
+{
+    if( drumP )
+    {
+        if( drumShared )
         {
-            memset(buffer + drumSplitCount + (gotbytes / sizeof(Word)), 0, wantbytes - gotbytes);
+            msync(drumP, drumSize, MS_SYNC);
         }
+        munmap(drumP, drumSize);
+        drumP = 0;
     }
 }
 
-// Do a drum write handling drum wraparound
+// a field the image doesn't have reads as zeros, writes to it go nowhere
+static Word *
+drumTrack(int field, int forWrite)
+{
+    if( field < drumFields )
+    {
+        return( drumP + (field * 4096) );
+    }
+
+    iotLog("IOT 61 field %o not in the drum image\n", field);
+    return( forWrite ? lostTrack : zeroTrack );
+}
+
 static void
-writeBufferToDrum(
-    int drumFd,         // file descriptor for our 'drum'
-    Word *buffer,       // must be at least 4096, anything over is unused
-    int drumField,      // which 4K block on drum
-    int drumAddr,       // start point relative to drum index
-    int transferCount)  // number of words to transfer
+syncDone(PDP1 *pdp1P, void *argP)
+{
+    syncRunning = 0;
+}
+
+// Copy between the drum and core, handling drum wraparound. The memory side wraps within its bank in the HSC.
+// For a read and write of the same field the old drum contents are saved first, the write would overwrite them.
+static void
+transferDrum(PDP1 *pdp1P, int chanFlags)
 {
 int drumSplitCount = 0;
 int drumRemainderCount = 0;
+Word *readP, *writeP;
 
     if( (drumAddr + transferCount) > 4095 )
     {
@@ -368,15 +511,31 @@ int drumRemainderCount = 0;
         drumRemainderCount = 0;
     }
 
-    iotLog("write buffer to drum, drumSplitCount %d, drumRemainderCount %d\n", drumSplitCount, drumRemainderCount);
+    iotLog("transfer drum, drumSplitCount %d, drumRemainderCount %d\n", drumSplitCount, drumRemainderCount);
+
+    readP = readMode ? drumTrack(drumReadField, 0) : 0;
+    writeP = writeMode ? drumTrack(drumWriteField, 1) : 0;
+
+    if( readMode && writeMode && (drumReadField == drumWriteField) )
+    {
+        memcpy(readBuffer, readP + drumAddr, drumSplitCount * sizeof(Word));
+        memcpy(readBuffer + drumSplitCount, readP, drumRemainderCount * sizeof(Word));
+
+        HSC_request_channel(pdp1P, 1, chanFlags, drumSplitCount, memBank, memAddr,
+            readBuffer, writeP + drumAddr);
+        if( drumRemainderCount )
+        {
+            HSC_request_channel(pdp1P, 1, chanFlags, drumRemainderCount, memBank, (memAddr + drumSplitCount) & 07777,
+                readBuffer + drumSplitCount, writeP);
+        }
+        return;
+    }
 
-    lseek(drumFd, DRUMADDRTOSEEK(drumField, drumAddr), SEEK_SET);
-    write(drumFd, buffer, sizeof(Word) * drumSplitCount);
+    HSC_request_channel(pdp1P, 1, chanFlags, drumSplitCount, memBank, memAddr,
+        readP ? readP + drumAddr : 0, writeP ? writeP + drumAddr : 0);
     if( drumRemainderCount )
     {
-        iotLog("writing remainder from buffer location %d to disk offset %o\n", drumSplitCount,
-            DRUMADDRTOSEEK(drumField, 0));
-        lseek(drumFd, DRUMADDRTOSEEK(drumField, 0), SEEK_SET);
-        write(drumFd, buffer + drumSplitCount, sizeof(Word) * drumRemainderCount);
+        HSC_request_channel(pdp1P, 1, chanFlags, drumRemainderCount, memBank, (memAddr + drumSplitCount) & 07777,
+            readP, writeP);
     }
 }
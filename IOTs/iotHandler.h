@@ -15,6 +15,10 @@ void iotStop(void);
 void iotPoll(PDP1 *);
 void initiateBreak(int chan);
 void enablePolling(int cycles);
+void pollAt(u64 when);
+void pollEvery(u64 ns);
+void pollOnFd(int fd);
+int submitJob(IotJobP work, IotJobDoneP done, void *arg, u64 when);
 int iotIsAlias(void);
 
 // Hidden method and vars used for control, implemented here to hide details from handlers
@@ -28,12 +32,46 @@ void _setIotControlBlock(IotEntryP cbP)
     _iotControlBlockP = cbP;
 }
 
+// Request a sequence break on chan. Safe from any thread, it's taken up between instructions.
 void initiateBreak(int chan)
 {
     dynamicIotProcessBreak(chan);
 }
 
-void enablePolling(int on)
+// Poll every 'cycles' instruction cycles (5us each), 0 to stop. Kept for older handlers.
+void enablePolling(int cycles)
 {
-    _iotControlBlockP->pollEnabled = on;
+    if( cycles )
+    {
+        pollEvery((u64)cycles * 5000);
+    }
+    else
+    {
+        dynamicIotSetPoll(_iotControlBlockP, NEVER, 0);
+    }
+}
+
+// Poll once when simtime reaches 'when', NEVER to cancel
+void pollAt(u64 when)
+{
+    dynamicIotSetPoll(_iotControlBlockP, when, 0);
+}
+
+// Poll every 'ns' of simulated time, starting one period from now, 0 to stop
+void pollEvery(u64 ns)
+{
+    dynamicIotPollEvery(_iotControlBlockP, ns);
+}
+
+// Poll whenever fd is readable, -1 to stop. Costs nothing while it isn't.
+void pollOnFd(int fd)
+{
+    dynamicIotSetPollFd(_iotControlBlockP, fd);
+}
+
+// Run work(arg) on a worker thread, then done(pdp, arg) between cycles once it's finished
+// and simtime has reached 'when' (0 for as soon as possible). Returns -1 if no workers.
+int submitJob(IotJobP work, IotJobDoneP done, void *arg, u64 when)
+{
+    return( dynamicIotSubmit(_iotControlBlockP, work, done, arg, when) );
 }
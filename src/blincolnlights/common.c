@@ -292,6 +292,9 @@ split(char *line, int *pargc)
 			}
 		}
 		*lp++ = '\0';
+		// don't step over the end
+		if(*line == '\0')
+			break;
 	}
 	if(pargc) *pargc = argc;
 	argv[argc++] = nil;
@@ -43,9 +43,19 @@ typedef struct FD FD;
 struct FD
 {
 	int fd;
-	int ready;
-	int id;
+	int id;		// watched if >= 0
+	u8 buf[256];	// read ahead
+	int pos, n;
+	int eof;
+	void (*ready)(FD *fd);	// if set, called instead of reading, see rearmfd()
+	void *arg;
 };
 void startpolling(void);
 void waitfd(FD *fd);
 void closefd(FD *fd);
+void unwatchfd(FD *fd);
+void rearmfd(FD *fd);
+void pollfds(int ms);
+void pollwake(void);
+int fdgetc(FD *fd);
+#define fdready(f) ((f)->pos < (f)->n || (f)->eof)
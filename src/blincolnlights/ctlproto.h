@@ -0,0 +1,64 @@
+// binary control protocol on port 1040
+//
+// A client that starts with CTL_MAGIC speaks frames instead of text
+// lines for the rest of the connection. Everything is little endian.
+//	request		u8 CTL_MAGIC, u8 op, u16 tag, u32 len, payload[len]
+//	response	u8 CTL_MAGIC, u8 status, u16 tag, u32 len, payload[len]
+// Requests are run in order between instructions, one response each
+// with the tag of its request, so a client can send many requests
+// before it reads the responses. Responses wait in a queue on the
+// connection, never in the emulator; while a lot of them are unread
+// the emulator stops taking requests from that client.
+//
+//	CTL_READ	u32 addr, u32 n		-> n u32 words
+//	CTL_WRITE	u32 addr, n u32 words	->
+//	CTL_REGS				-> CTL_NREGS u32, see below
+//	CTL_RUN		[u32 addr]		->	continue, or start at addr
+//	CTL_STOP				->	stop at the end of the cycle
+//	CTL_STEP				-> registers, after one instruction if stopped
+//	CTL_TEXT	command line		-> text reply
+// addr is an extended 16 bit address, n at most CTL_MAXWORDS.
+
+#define CTL_MAGIC 0xC7
+#define CTL_HDRSZ 8
+#define CTL_MAXWORDS 010000
+#define CTL_MAXLEN (8 + 4*CTL_MAXWORDS)
+
+enum {
+	CTL_READ = 1,
+	CTL_WRITE,
+	CTL_REGS,
+	CTL_RUN,
+	CTL_STOP,
+	CTL_STEP,
+	CTL_TEXT,
+};
+
+// status
+enum {
+	CTL_OK,
+	CTL_EOP,	// unknown op
+	CTL_EADDR,	// address out of range
+	CTL_ELEN,	// bad payload length
+	CTL_EPOWER,	// machine is off
+};
+
+// CTL_REGS order
+enum {
+	CTL_AC,
+	CTL_IO,
+	CTL_PC,		// with the extension bits
+	CTL_MA,
+	CTL_MB,
+	CTL_IR,
+	CTL_OV,
+	CTL_PF,
+	CTL_SS,		// sense switches
+	CTL_TW,		// test word
+	CTL_TA,		// test address, with extension
+	CTL_RUNNING,
+	CTL_CYC,
+	CTL_EXD,	// extend mode
+	CTL_SBM,	// sequence break mode
+	CTL_NREGS
+};
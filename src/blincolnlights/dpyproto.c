@@ -0,0 +1,485 @@
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include "dpyproto.h"
+
+/*
+ * v2 display protocol, see dpyproto.h
+ */
+
+static uint8_t*
+putvarint(uint8_t *p, uint32_t v)
+{
+	while(v >= 0x80) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static uint8_t*
+putcoord(uint8_t *p, int *tag, int shift, int v, int last)
+{
+	int d = v - last;
+	if(d == 0)
+		return p;
+	if(d >= -128 && d <= 127) {
+		*tag |= 1<<shift;
+		*p++ = d;
+	} else {
+		*tag |= 2<<shift;
+		*p++ = v;
+		*p++ = v>>8;
+	}
+	return p;
+}
+
+static int
+encoderecords(const uint32_t *cmds, int ncmds, uint8_t *out)
+{
+	int i, tag;
+	int x, y, in, dt;
+	int lx, ly, li, ldt;
+	uint32_t w;
+	uint8_t *p, *tp;
+
+	lx = ly = li = ldt = 0;
+	p = out;
+	for(i = 0; i < ncmds; i++) {
+		w = cmds[i];
+		dt = w>>23;
+		if(dt == 511) {
+			// escape pairs are never split across blocks
+			*p++ = 0x80;
+			p = putvarint(p, i+1 < ncmds ? cmds[++i] : 0);
+			continue;
+		}
+		x = w & 01777;
+		y = w>>10 & 01777;
+		in = w>>20 & 7;
+
+		tag = 0;
+		tp = p++;
+		p = putcoord(p, &tag, 0, x, lx);
+		p = putcoord(p, &tag, 2, y, ly);
+		if(in != li) {
+			tag |= 020;
+			*p++ = in;
+		}
+		if(dt != ldt) {
+			if(dt < 256) {
+				tag |= 040;
+				*p++ = dt;
+			} else {
+				tag |= 0100;
+				*p++ = dt;
+				*p++ = dt>>8;
+			}
+		}
+		*tp = tag;
+		lx = x;
+		ly = y;
+		li = in;
+		ldt = dt;
+	}
+	return p - out;
+}
+
+int
+dpy2encode(const uint32_t *cmds, int ncmds, uint8_t *out, int flags)
+{
+	uint8_t raw[ncmds*8 + 1];
+	uint8_t *p;
+	int rawlen, len;
+
+	rawlen = encoderecords(cmds, ncmds, raw);
+	p = out + DPY2_HDRSZ;
+	len = -1;
+	if(flags & DPY2_LZ)
+		len = lzcompress(raw, rawlen, p, rawlen-1);
+	if(len < 0) {
+		// incompressible, send as is
+		flags &= ~DPY2_LZ;
+		memcpy(p, raw, rawlen);
+		len = rawlen;
+	}
+	out[0] = DPY2_MAGIC;
+	out[1] = flags;
+	out[2] = len;
+	out[3] = len>>8;
+	out[4] = rawlen;
+	out[5] = rawlen>>8;
+	return DPY2_HDRSZ + len;
+}
+
+#define GET(c) if(p >= e) return -1; else c = *p++
+
+static const uint8_t*
+getcoord(const uint8_t *p, const uint8_t *e, int mode, int *v)
+{
+	switch(mode) {
+	case 0:
+		break;
+	case 1:
+		if(e-p < 1)
+			return NULL;
+		*v = (*v + (int8_t)p[0]) & 01777;
+		p++;
+		break;
+	case 2:
+		if(e-p < 2)
+			return NULL;
+		*v = (p[0] | p[1]<<8) & 01777;
+		p += 2;
+		break;
+	default:
+		return NULL;
+	}
+	return p;
+}
+
+int
+dpy2decode(const uint8_t *p, int len, uint32_t *cmds, int maxcmds)
+{
+	const uint8_t *e;
+	int n, tag, c, c2, shift;
+	int x, y, in, dt;
+	uint32_t v;
+
+	e = p + len;
+	n = 0;
+	x = y = in = dt = 0;
+	while(p < e) {
+		tag = *p++;
+		if(tag & 0x80) {
+			v = 0;
+			shift = 0;
+			do {
+				GET(c);
+				v |= (uint32_t)(c & 0x7F) << shift;
+				shift += 7;
+			} while(c & 0x80);
+			if(n+2 > maxcmds)
+				return -1;
+			cmds[n++] = 511u<<23;
+			cmds[n++] = v;
+			continue;
+		}
+		if((p = getcoord(p, e, tag&3, &x)) == NULL ||
+		   (p = getcoord(p, e, tag>>2 & 3, &y)) == NULL)
+			return -1;
+		if(tag & 020) {
+			GET(c);
+			in = c & 7;
+		}
+		if(tag & 040) {
+			GET(dt);
+		} else if(tag & 0100) {
+			GET(c);
+			GET(c2);
+			dt = c | c2<<8;
+		}
+		if(n >= maxcmds)
+			return -1;
+		cmds[n++] = x | y<<10 | in<<20 | (uint32_t)dt<<23;
+	}
+	return n;
+}
+
+/*
+ * LZ4-style block compression.
+ * A block is a sequence of
+ *	token, [literal length], literals, offset, [match length]
+ * the high nibble of the token is the literal length,
+ * the low nibble the match length-4, 15 means more bytes follow.
+ * The last sequence has literals only.
+ */
+
+#define LZHASH 12
+#define MINMATCH 4
+
+static uint32_t
+load32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint8_t*
+putlen(uint8_t *p, int l)
+{
+	while(l >= 255) {
+		*p++ = 255;
+		l -= 255;
+	}
+	*p++ = l;
+	return p;
+}
+
+int
+lzcompress(const uint8_t *src, int n, uint8_t *dst, int max)
+{
+	int tab[1<<LZHASH];
+	int ip, anchor, ref, len, lit, h;
+	uint8_t *op, *oe, *tok;
+	uint32_t v;
+
+	if(max <= 0 || n > 65535)
+		return -1;
+	memset(tab, 0xFF, sizeof(tab));
+	op = dst;
+	oe = dst + max;
+	ip = 0;
+	anchor = 0;
+	while(ip + MINMATCH <= n) {
+		v = load32(src+ip);
+		h = (v*2654435761u) >> (32-LZHASH);
+		ref = tab[h];
+		tab[h] = ip;
+		if(ref < 0 || load32(src+ref) != v) {
+			ip++;
+			continue;
+		}
+		len = MINMATCH;
+		while(ip+len < n && src[ref+len] == src[ip+len])
+			len++;
+
+		lit = ip - anchor;
+		if(op + 1 + lit + lit/255 + 1 + 2 + len/255 + 1 > oe)
+			return -1;
+		tok = op++;
+		*tok = (lit < 15 ? lit : 15)<<4 | (len-MINMATCH < 15 ? len-MINMATCH : 15);
+		if(lit >= 15)
+			op = putlen(op, lit-15);
+		memcpy(op, src+anchor, lit);
+		op += lit;
+		*op++ = ip-ref;
+		*op++ = (ip-ref)>>8;
+		if(len-MINMATCH >= 15)
+			op = putlen(op, len-MINMATCH-15);
+		ip += len;
+		anchor = ip;
+	}
+
+	lit = n - anchor;
+	if(op + 1 + lit + lit/255 + 1 > oe)
+		return -1;
+	*op++ = (lit < 15 ? lit : 15)<<4;
+	if(lit >= 15)
+		op = putlen(op, lit-15);
+	memcpy(op, src+anchor, lit);
+	op += lit;
+	return op - dst;
+}
+
+int
+lzdecompress(const uint8_t *src, int n, uint8_t *dst, int max)
+{
+	const uint8_t *ip, *ie, *m;
+	uint8_t *op, *oe;
+	int tok, lit, len, off, c;
+
+	ip = src;
+	ie = src + n;
+	op = dst;
+	oe = dst + max;
+	while(ip < ie) {
+		tok = *ip++;
+		lit = tok>>4;
+		if(lit == 15)
+			do {
+				if(ip >= ie) return -1;
+				c = *ip++;
+				lit += c;
+			} while(c == 255);
+		if(lit > ie-ip || lit > oe-op)
+			return -1;
+		memcpy(op, ip, lit);
+		op += lit;
+		ip += lit;
+		if(ip >= ie)
+			break;
+
+		if(ie-ip < 2)
+			return -1;
+		off = ip[0] | ip[1]<<8;
+		ip += 2;
+		if(off == 0 || off > op-dst)
+			return -1;
+		len = (tok&15) + MINMATCH;
+		if((tok&15) == 15)
+			do {
+				if(ip >= ie) return -1;
+				c = *ip++;
+				len += c;
+			} while(c == 255);
+		if(len > oe-op)
+			return -1;
+		// may overlap
+		for(m = op-off; len--;)
+			*op++ = *m++;
+	}
+	return op - dst;
+}
+
+/*
+ * client side
+ */
+
+void
+dpyinit(DpyStream *s, int fd, int version, int flags)
+{
+	uint32_t w;
+
+	s->fd = fd;
+	s->proto = 1;
+	s->esc = 0;
+	s->nbuf = 0;
+	s->idle = DPY_IDLE;
+	s->tesc = 0;
+	s->credit = 0;
+	s->then = 0;
+	if(version > 1) {
+		w = DPY_HELLO(version, flags);
+		write(fd, &w, 4);
+	}
+}
+
+static int
+fill(DpyStream *s)
+{
+	int n = read(s->fd, s->buf+s->nbuf, sizeof(s->buf)-s->nbuf);
+	if(n <= 0)
+		return -1;
+	s->nbuf += n;
+	return 0;
+}
+
+static void
+consume(DpyStream *s, int n)
+{
+	memmove(s->buf, s->buf+n, s->nbuf-n);
+	s->nbuf -= n;
+}
+
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+// take time we already aged locally out of what the emulator sends
+static void
+settle(DpyStream *s, uint32_t *cmds, int n)
+{
+	uint32_t dt, d;
+	int i;
+
+	s->then = now();
+	for(i = 0; i < n; i++) {
+		if(s->tesc) {
+			s->tesc = 0;
+			d = cmds[i] < s->credit ? cmds[i] : s->credit;
+			cmds[i] -= d;
+			s->credit -= d;
+		} else if((cmds[i]>>23) == 511)
+			s->tesc = 1;
+		else if(s->credit) {
+			dt = cmds[i]>>23;
+			d = dt < s->credit ? dt : s->credit;
+			cmds[i] -= d<<23;
+			s->credit -= d;
+		}
+	}
+}
+
+static int
+readblock(DpyStream *s, uint32_t *cmds, int maxcmds, int *local)
+{
+	int i, n, len, rawlen;
+	uint32_t w;
+	uint8_t *p;
+	struct pollfd pfd;
+	uint64_t t;
+
+	for(;;) {
+		if(s->proto == 1) {
+			n = s->nbuf/4;
+			if(n > maxcmds)
+				n = maxcmds;
+			for(i = 0; i < n; i++) {
+				memcpy(&w, s->buf+i*4, 4);
+				if(!s->esc && DPY_ISSWITCH(w)) {
+					consume(s, i*4+4);
+					s->proto = w & 0xFF;
+					if(i > 0)
+						return i;
+					goto again;
+				}
+				s->esc = !s->esc && (w>>23) == 511;
+				cmds[i] = w;
+			}
+			if(n > 0) {
+				consume(s, n*4);
+				return n;
+			}
+		} else {
+			p = s->buf;
+			if(s->nbuf >= DPY2_HDRSZ) {
+				if(p[0] != DPY2_MAGIC)
+					return -1;
+				len = p[2] | p[3]<<8;
+				rawlen = p[4] | p[5]<<8;
+				if(s->nbuf >= DPY2_HDRSZ+len) {
+					if(p[1] & DPY2_LZ) {
+						if(lzdecompress(p+DPY2_HDRSZ, len, s->raw, sizeof(s->raw)) != rawlen)
+							return -1;
+						n = dpy2decode(s->raw, rawlen, cmds, maxcmds);
+					} else
+						n = dpy2decode(p+DPY2_HDRSZ, len, cmds, maxcmds);
+					consume(s, DPY2_HDRSZ+len);
+					if(n != 0)
+						return n;
+					continue;
+				}
+			}
+		}
+		if(s->idle && s->nbuf == 0 && !s->esc && maxcmds >= 2) {
+			pfd.fd = s->fd;
+			pfd.events = POLLIN;
+			if(poll(&pfd, 1, s->idle) == 0) {
+				// nothing displayed, age locally
+				t = now();
+				cmds[0] = 511u<<23;
+				cmds[1] = s->then ? t - s->then : 0;
+				s->credit += cmds[1];
+				s->then = t;
+				*local = 1;
+				return 2;
+			}
+		}
+		if(fill(s) < 0)
+			return -1;
+	again:;
+	}
+}
+
+// read the next batch of display commands as v1 words
+// returns number of words or -1 on EOF or protocol error
+int
+dpyread(DpyStream *s, uint32_t *cmds, int maxcmds)
+{
+	int n, local;
+
+	local = 0;
+	n = readblock(s, cmds, maxcmds, &local);
+	if(n > 0 && !local)
+		settle(s, cmds, n);
+	return n;
+}
@@ -0,0 +1,67 @@
+// display protocol shared between emulator and display clients
+//
+// v1 is a stream of little endian 32 bit words:
+//	x | y<<10 | i<<20 | dt<<23	one point, dt in us since the last one
+//	511<<23, dt			escape, dt us without a point
+// dt 511 is reserved for escapes.
+// The emulator sends points at most once per frame period and nothing
+// at all while no points are displayed. An escape is added to every
+// flush to bring the clients up to the current time. In between
+// clients age the display in real time, see dpyread().
+//
+// A client may ask for v2 by sending DPY_HELLO(version, flags).
+// The emulator answers at the next flush with DPY_SWITCH(version, flags)
+// in the v1 stream, everything after that word is sent as v2 blocks:
+//	u8 DPY2_MAGIC, u8 flags, u16 len, u16 rawlen, payload[len]
+// the payload is LZ4-style compressed if DPY2_LZ is set in flags.
+// Decompressed it's a sequence of records, starting with a tag byte:
+//	0x80, varint dt			escape
+//	tag [x] [y] [i] [dt]		point
+// with tag bits
+//	0-1	x: 0 same, 1 s8 delta, 2 u16 absolute
+//	2-3	y: same
+//	4	intensity byte follows, else same
+//	5-6	dt: 0 same, 1 u8, 2 u16
+// All "same" state is reset to 0 at the start of a block.
+
+#include <stdint.h>
+
+#define DPY_HELLO(v, f) (0xFEu<<24 | (f)<<8 | (v))
+#define DPY_SWITCH(v, f) (511u<<23 | 1u<<22 | (f)<<8 | (v))
+#define DPY_ISSWITCH(w) (((w) & ~0xFFFFu) == (511u<<23 | 1u<<22))
+#define DPY_PEN 0xFFu
+
+#define DPY2_MAGIC 0xD2
+#define DPY2_HDRSZ 6
+#define DPY2_LZ 1
+// 8 bytes per point worst case, then LZ expansion
+#define DPY2_MAXBLK(ncmds) (DPY2_HDRSZ + (ncmds)*8 + (ncmds)*8/255 + 16)
+
+// emulator side: v1 words to a complete v2 block, returns size
+int dpy2encode(const uint32_t *cmds, int ncmds, uint8_t *out, int flags);
+
+// client side: block payload to v1 words, returns number of words or -1
+int dpy2decode(const uint8_t *p, int len, uint32_t *cmds, int maxcmds);
+
+int lzcompress(const uint8_t *src, int n, uint8_t *dst, int max);
+int lzdecompress(const uint8_t *src, int n, uint8_t *dst, int max);
+
+// client side stream reader, handles the switch from v1 to v2
+typedef struct DpyStream DpyStream;
+struct DpyStream
+{
+	int fd;
+	int proto;
+	int esc;
+	int idle;	// ms without data before aging locally, 0 never
+	int tesc;	// escape state of what we return
+	uint32_t credit;	// us aged locally, not yet seen in the stream
+	uint64_t then;
+	uint8_t buf[65536];
+	int nbuf;
+	uint8_t raw[65536];
+};
+#define DPY_IDLE 33	// ms, one frame
+
+void dpyinit(DpyStream *s, int fd, int version, int flags);
+int dpyread(DpyStream *s, uint32_t *cmds, int maxcmds);
@@ -3,10 +3,14 @@
 #include "lowpass.h"
 
 #include <SDL2/SDL.h>
+#include <math.h>
 
-#define SAMPLE_RATE (5714*1)          // one sample every 175 us, it's what the original did, oversample if desired
-#define SAMPLE_TIME (1000000000/SAMPLE_RATE)  // one sample every 175 us, it's what the original did, oversample by 6
-#define PRELOAD 64                          // number of samples to accumulate in SDL buffer before playing
+#define SAMPLE_RATE 48000                   // what we ask SDL for, we use whatever it gives us
+#define ORIG_RATE 5714                      // one sample every 175 us, it's what the original did, alpha is relative to this
+#define BLOCK 256                           // samples per SDL callback
+#define LATENCY (50*1000*1000)              // ns the audio plays behind the emulator, hides emulator stalls
+#define EVENTS 8192                         // size of the pf change ring, power of 2
+#define WAVBUF 1024                         // frames buffered before writing the wav file
 
 // The values we use for the square wave
 #define HIVAL   1.0
@@ -15,17 +19,68 @@
 // Filter settings
 #define ALPHA 0.10                           // initial value, generally works well
 
-// A FILTERGAIN of 0.0 is the same as 1.0, but avoids one floating multiply per cycle.
-// Normaally, use 0.0 and adjust the gain with MIXGAIN.
-#define FILTERGAIN 0.0
-
 // And output scaling
 // Warning - SDL will clip any audio value <-1.0 or >1.0, so don't set the gain too high, you'll have to experiment.
 #define MIXGAIN 1.5                         // works with the default alpha of 0.1
 
+// The emulator only records when the program flags change, the audio thread
+// turns that into samples a block at a time in the SDL callback.
+// Single producer, single consumer, so no locks are needed.
+// The audio thread keeps the last 2*LATENCY of changes around so that it
+// can back up when tuning makes it play faster than the emulator runs.
+typedef struct {
+    u64 time;                   // simtime of the change
+    int pf;
+} PfEvent;
+
+static PfEvent events[EVENTS];
+static volatile u32 evHead;     // only the emulator writes this
+static volatile u32 evTail;     // only the audio thread writes this
+static volatile u64 emuTime;    // how far the emulator got
+static int lastPf = -1;         // emulator side
+
+// wje - all four voices go through the synthesizer side by side in one vector,
+// gcc turns this into SSE on x86 and NEON on the Pi, no intrinsics needed.
+typedef float v4f __attribute__((vector_size(16)));
+
+// Each flag edge is placed at its exact simtime between two samples with a
+// polyBLEP correction spread over those two samples, so edges shorter than a
+// sample don't alias or get lost.
+// level is the flag level after all edges so far, pend[0] is the correction
+// still owed to the next sample, pend[1] to the one after that.
+typedef struct {
+    double time;                // simtime of the next sample
+    double step;                // ns of simtime per sample
+    v4f level;
+    v4f pend[2];
+    v4f filt;                   // one pole lowpass, one per voice
+    float a;                    // its coefficient at our sample rate
+} Synth;
+
+// audio thread side
+static Synth synth;
+static u32 playNext;            // next event to play, between evTail and evHead
+static int playPf;
+static int playing;
+
+// wav recorder, emulator side, runs on simtime alone
+typedef struct {
+    FILE *f;
+    int rate;
+} WavOpen;
+
+int recaudio;                   // the emulator calls svc_wav while set
+static WavOpen *volatile wavNew;    // handed over by startwav
+static volatile int wavStop;
+static FILE *wavFile;
+static int wavRate = SAMPLE_RATE;
+static Synth wavSynth;
+static int wavPf;
+static u32 wavFrames;
+static float wavBuf[2*WAVBUF];
+static int wavN;
+
 static SDL_AudioDeviceID dev;
-static int nsamples;
-static u64 nexttime;
 static int isStopped = 1;
 static int isInitialized = 0;
 static int sampleRate = SAMPLE_RATE;
@@ -34,12 +89,76 @@ static float alpha = ALPHA;
 static float mixerGain = MIXGAIN;
 static float tuning = 1.0;
 
-static FilterSpec voice1;
-static FilterSpec voice2;
-static FilterSpec voice3;
-static FilterSpec voice4;
-
 static void openAudio(void);
+static void audioCallback(void *userdata, Uint8 *stream, int len);
+
+static v4f
+pfLevels(int pf)
+{
+    v4f v = {
+        (pf & PF_1)?HIVAL:LOWVAL,
+        (pf & PF_2)?HIVAL:LOWVAL,
+        (pf & PF_3)?HIVAL:LOWVAL,
+        (pf & PF_4)?HIVAL:LOWVAL
+    };
+
+    return( v );
+}
+
+// The filter was tuned for ORIG_RATE, keep its cutoff where it was at any rate
+static float
+filterCoeff(float a, int rate)
+{
+    return( 1.0 - powf(1.0 - a, (float)ORIG_RATE / rate) );
+}
+
+static void
+synthInit(Synth *s, int rate, float tune, double time, int pf)
+{
+    memset(s, 0, sizeof(*s));
+    s->time = time;
+    s->step = 1e9 / rate * tune;
+    s->level = pfLevels(pf);
+    s->filt = pfLevels(0);
+    s->a = filterCoeff(alpha, rate);
+}
+
+// flags change at simtime t, which is before the sample after next
+static void
+synthEdge(Synth *s, double t, int pf)
+{
+v4f new, h;
+float d;
+
+    new = pfLevels(pf);
+    h = new - s->level;
+    d = (t - s->time) / s->step;
+    if( d < 0.0 )
+        d = 0.0;            // late, put it at the next sample
+    if( d > 1.0 )
+        d = 1.0;
+
+    // the next sample sees the old level plus a bit of the step,
+    // the one after the new level minus the rest
+    s->pend[0] += h * ((1.0f-d)*(1.0f-d)*0.5f - 1.0f);
+    s->pend[1] -= h * (d*d*0.5f);
+    s->level = new;
+}
+
+// produce the next sample, left gets voices 1 and 2, right 3 and 4
+static void
+synthSample(Synth *s, float *out)
+{
+v4f y;
+
+    y = s->level + s->pend[0];
+    s->pend[0] = s->pend[1];
+    s->pend[1] = (v4f){ 0, 0, 0, 0 };
+    s->filt += s->a * (y - s->filt);
+
+    out[0] = mixSamples(s->filt[0], s->filt[1], mixerGain);
+    out[1] = mixSamples(s->filt[2], s->filt[3], mixerGain);
+}
 
 void
 initaudio(void)
@@ -49,31 +168,35 @@ initaudio(void)
 
 	SDL_Init(SDL_INIT_AUDIO);
 
-    // Be careful with the gain, SDL will clip if the sample value sent to it is outside the range of -1.0 to 1.0.
-    // HIVAL, LOWVAL are the maximum ranges for SDL input, so the gain should generally not be greater than 1.
-    initializeFilter(&voice1, alpha, FILTERGAIN, LOWVAL);
-    initializeFilter(&voice2, alpha, FILTERGAIN, LOWVAL);
-    initializeFilter(&voice3, alpha, FILTERGAIN, LOWVAL);
-    initializeFilter(&voice4, alpha, FILTERGAIN, LOWVAL);
-
     openAudio();
 
     isInitialized = 1;
-    isStopped = 1;
+
+    // start over with whatever the emulator does next
+    SDL_LockAudioDevice(dev);
+    evTail = evHead;
+    playing = 0;
+    lastPf = -1;
+    SDL_UnlockAudioDevice(dev);
+
+    isStopped = 0;
+	SDL_PauseAudioDevice(dev, 0);
 }
 
 static void
 openAudio()
 {
-	SDL_AudioSpec spec;
+	SDL_AudioSpec spec, have;
 
 	memset(&spec, 0, sizeof(spec));
-	spec.freq = sampleRate;        // the original did one sample every 175 us, replicate by default
+	spec.freq = sampleRate;
 	spec.format = AUDIO_F32;
 	spec.channels = 2;
-	spec.samples = 1024;            // SDL's buffer size
-	spec.callback = nil;
-	dev = SDL_OpenAudioDevice(nil, 0, &spec, nil, 0);
+	spec.samples = BLOCK;           // SDL's buffer size
+	spec.callback = audioCallback;
+	dev = SDL_OpenAudioDevice(nil, 0, &spec, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if( dev != 0 )
+        sampleRate = have.freq;
 }
 
 int
@@ -100,9 +223,6 @@ stopaudio(void)
 		return;
 
 	SDL_PauseAudioDevice(dev, 1);
-	SDL_ClearQueuedAudio(dev);
-	nsamples = 0;
-	nexttime = 0;
     isStopped = 1;
 }
 
@@ -112,58 +232,128 @@ continueaudio(void)
 	if( (dev == 0) || !isStopped || !isInitialized )
 		return;
 
-	SDL_ClearQueuedAudio(dev);              // clean things up, svc_audio() will unpause
-	nsamples = 0;
-	nexttime = 0;
+    SDL_LockAudioDevice(dev);
+    evTail = evHead;
+    playing = 0;
+    lastPf = -1;
+    SDL_UnlockAudioDevice(dev);
+
     isStopped = 0;
+	SDL_PauseAudioDevice(dev, 0);
 }
 
+// Called from the emulator loop, just note pf changes
 void
 svc_audio(PDP1 *pdp)
 {
-float chan1, chan2, chan3, chan4;
-float buffer[2];
+    u32 head;
+    PfEvent *ev;
 
-	u8 s;
-
-	if( (dev == 0) || (nexttime >= pdp->simtime) || !isInitialized || isStopped )
+	if( !isInitialized || isStopped )
 		return;
 
-	if(nexttime == 0)
-		nexttime = pdp->simtime + SAMPLE_TIME;
-	else
-		nexttime += SAMPLE_TIME;
+    if( pdp->pf != lastPf )
+    {
+        head = evHead;
+        // if the audio thread doesn't keep up, drop the change, we'll try again next time
+        if( (head - __atomic_load_n(&evTail, __ATOMIC_ACQUIRE)) < EVENTS )
+        {
+            ev = &events[head & (EVENTS-1)];
+            ev->time = pdp->simtime;
+            ev->pf = pdp->pf;
+            __atomic_store_n(&evHead, head+1, __ATOMIC_RELEASE);
+            lastPf = pdp->pf;
+        }
+    }
+    __atomic_store_n(&emuTime, pdp->simtime, __ATOMIC_RELEASE);
+}
+
+// Move playback to simtime t, the level jumps to whatever the flags were then
+static void
+seekTo(u64 t, u32 head)
+{
+    while( (playNext != evTail) && (events[(playNext-1) & (EVENTS-1)].time > t) )
+        playNext--;
+    while( (playNext != head) && (events[playNext & (EVENTS-1)].time <= t) )
+        playNext++;
+    if( playNext != evTail )
+        playPf = events[(playNext-1) & (EVENTS-1)].pf;
+
+    synth.time = t;
+    synthEdge(&synth, t, playPf);
+}
 
-	// queue up a reasonable number of samples, power of 2 is preferred
-	if(nsamples < PRELOAD) {
-		nsamples++;
-	}
+// SDL calls this from its audio thread whenever it needs another block
+static void
+audioCallback(void *userdata, Uint8 *stream, int len)
+{
+float *out = (float *)stream;
+int nframes = len / (2 * sizeof(float));
+double end;
+u64 now, keep;
+u32 head, tail;
+PfEvent *ev;
+int i;
+
+    now = __atomic_load_n(&emuTime, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&evHead, __ATOMIC_ACQUIRE);
+
+    if( !playing )
+    {
+        playing = 1;
+        playNext = evTail;
+        playPf = 0;
+        synthInit(&synth, sampleRate, tuning, (now > LATENCY) ? now - LATENCY : 0, 0);
+        seekTo(synth.time, head);
+    }
     else
     {
-		// then start playing
-        SDL_PauseAudioDevice(dev, 0);
+        // wje - tuning plays simtime faster or slower than real time, so the
+        // distance to the emulator drifts. Keep it around LATENCY by skipping
+        // ahead or backing up a block's worth, like a tape varispeed would.
+        if( now > synth.time + 3*LATENCY )
+            seekTo(now - LATENCY, head);
+        else if( (tuning > 1.0) && (now < synth.time + LATENCY/4) && (synth.time > LATENCY) )
+            seekTo(synth.time - LATENCY, head);
     }
 
-    // filter each channel
-    chan1 = lowPassFilter(&voice1,(pdp->pf & 0x20)?HIVAL:LOWVAL);
-    chan2 = lowPassFilter(&voice2,(pdp->pf & 0x10)?HIVAL:LOWVAL);
-    chan3 = lowPassFilter(&voice3,(pdp->pf & 0x08)?HIVAL:LOWVAL);
-    chan4 = lowPassFilter(&voice4,(pdp->pf & 0x04)?HIVAL:LOWVAL);
-    // and downmix quad to stereo
-    buffer[0] = mixSamples(chan1, chan2, mixerGain);
-    buffer[1] = mixSamples(chan3, chan4, mixerGain);
+    for( i = 0; i < nframes; i++ )
+    {
+        // every edge up to the sample after this one has to be in
+        end = synth.time + synth.step;
+        while( playNext != head )
+        {
+            ev = &events[playNext & (EVENTS-1)];
+            if( ev->time > end )
+                break;
+            synthEdge(&synth, ev->time, ev->pf);
+            playPf = ev->pf;
+            playNext++;
+        }
+
+        synthSample(&synth, out);
+        out += 2;
 
-	SDL_QueueAudio(dev, buffer, 2 * sizeof(float));
+        // if the emulator stalls, hold the current level until it catches up
+        if( end <= now )
+            synth.time = end;
+    }
+
+    // forget what we can't back up into anymore
+    keep = (synth.time > 2*LATENCY) ? synth.time - 2*LATENCY : 0;
+    tail = evTail;
+    // the last change before that is still needed, it's the level there
+    while( (tail+1 != playNext) && (tail != playNext) && (events[(tail+1) & (EVENTS-1)].time < keep) )
+        tail++;
+    __atomic_store_n(&evTail, tail, __ATOMIC_RELEASE);
 }
 
 void
 setFilterAlpha(float newAlpha)
 {
     alpha = boundValue(newAlpha);
-    voice1.alpha = alpha;
-    voice2.alpha = alpha;
-    voice3.alpha = alpha;
-    voice4.alpha = alpha;
+    synth.a = filterCoeff(alpha, sampleRate);
+    wavSynth.a = filterCoeff(alpha, wavRate);
 }
 
 float
@@ -190,19 +380,14 @@ getMixerGain()
 }
 
 // 1.0 is no tuning, >1.0 raises pitch, <1.0 lowers pitch
-// Needs SDL3, which isn't being used currently, so this does nothing
+// We resample from simtime ourselves, so this just changes how much simtime a sample covers
 void
 setAudioTuning(float newTuning)
 {
     if( newTuning > 0.0 )
     {
         tuning = newTuning;
-        if( dev != 0 )
-        {
-        /* If we were using SDL2, this would be simple, but we're not.
-            SDL_SetAudioStreamFrequencyRatio(tuning);
-        */
-        }
+        synth.step = 1e9 / sampleRate * tuning;
     }
 }
 
@@ -211,3 +396,151 @@ getAudioTuning()
 {
     return( tuning );
 }
+
+// wje - Recording to a wav file doesn't need SDL or a sound card and follows
+// simtime only, so it sounds the same however fast the emulator runs.
+// Same synthesizer and mix as the live audio, but never tuned.
+
+static void
+putLE(u8 *p, u32 v, int n)
+{
+    while( n-- > 0 )
+    {
+        *p++ = v;
+        v >>= 8;
+    }
+}
+
+// 32 bit float stereo, the samples exactly as SDL gets them, so nothing clips.
+// Sizes are filled in when we're done.
+static void
+wavHeader(FILE *f, int rate, u32 frames)
+{
+u8 h[44];
+u32 bytes = frames * 8;
+
+    memcpy(h, "RIFF", 4);
+    putLE(h+4, 36 + bytes, 4);
+    memcpy(h+8, "WAVEfmt ", 8);
+    putLE(h+16, 16, 4);
+    putLE(h+20, 3, 2);              // IEEE float
+    putLE(h+22, 2, 2);              // stereo
+    putLE(h+24, rate, 4);
+    putLE(h+28, rate * 8, 4);       // bytes per second
+    putLE(h+32, 8, 2);              // bytes per frame
+    putLE(h+34, 32, 2);             // bits per sample
+    memcpy(h+36, "data", 4);
+    putLE(h+40, bytes, 4);
+    fwrite(h, 1, sizeof(h), f);
+}
+
+static void
+wavFlush(void)
+{
+    fwrite(wavBuf, 2*sizeof(float), wavN, wavFile);
+    wavFrames += wavN;
+    wavN = 0;
+}
+
+static void
+wavClose(void)
+{
+    wavFlush();
+    fseek(wavFile, 0, SEEK_SET);
+    wavHeader(wavFile, wavRate, wavFrames);
+    fclose(wavFile);
+    wavFile = nil;
+}
+
+// render every sample that lies before simtime t
+static void
+wavRender(double t)
+{
+    while( wavSynth.time + wavSynth.step < t )
+    {
+        synthSample(&wavSynth, &wavBuf[2*wavN]);
+        wavSynth.time += wavSynth.step;
+        if( ++wavN == WAVBUF )
+            wavFlush();
+    }
+}
+
+// Called from the emulator loop while recaudio is set, running or not
+void
+svc_wav(PDP1 *pdp)
+{
+WavOpen *w;
+
+    if( wavStop )
+    {
+        if( wavFile != nil )
+            wavClose();
+        if( (w = __atomic_exchange_n(&wavNew, nil, __ATOMIC_ACQUIRE)) != nil )
+        {
+            fclose(w->f);
+            free(w);
+        }
+        wavStop = 0;
+        recaudio = 0;
+        return;
+    }
+
+    if( (w = __atomic_exchange_n(&wavNew, nil, __ATOMIC_ACQUIRE)) != nil )
+    {
+        if( wavFile != nil )
+            wavClose();
+        wavFile = w->f;
+        wavRate = w->rate;
+        free(w);
+        wavFrames = 0;
+        wavN = 0;
+        wavPf = pdp->pf;
+        synthInit(&wavSynth, wavRate, 1.0, pdp->simtime, wavPf);
+        wavHeader(wavFile, wavRate, 0);
+    }
+
+    if( wavFile == nil )
+        return;
+
+    wavRender(pdp->simtime);
+    if( pdp->pf != wavPf )
+    {
+        wavPf = pdp->pf;
+        synthEdge(&wavSynth, pdp->simtime, wavPf);
+    }
+}
+
+// Start recording to file, replaces any recording in progress
+int
+startwav(const char *file, int rate)
+{
+FILE *f;
+WavOpen *w;
+
+    if( rate <= 0 )
+        rate = SAMPLE_RATE;
+    if( (f = fopen(file, "wb")) == nil )
+        return( -1 );
+
+    w = malloc(sizeof(*w));
+    w->f = f;
+    w->rate = rate;
+    wavStop = 0;
+    if( (w = __atomic_exchange_n(&wavNew, w, __ATOMIC_RELEASE)) != nil )
+    {
+        // the emulator never picked up the last one
+        fclose(w->f);
+        free(w);
+    }
+    recaudio = 1;
+
+    return( 0 );
+}
+
+// The emulator finishes the file at its next loop
+void
+stopwav(void)
+{
+    if( recaudio )
+        wavStop = 1;
+}
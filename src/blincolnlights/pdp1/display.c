@@ -0,0 +1,516 @@
+#include "common.h"
+#include "pdp1.h"
+#include "dpyproto.h"
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/*
+ * Display output stage.
+ * display() in pdp1.c converts each point once and, according to
+ * pdp->dpyroute, hands it to one or both screens with dpyplot().
+ * Every screen buffers v1 words and passes them on to its sinks
+ * when flushed. Sinks are display clients (v1 or v2 over TCP)
+ * or recorders writing v1 words to a file.
+ *
+ * Any number of clients (up to MAXDPYSINK) can watch a screen.
+ * Their output goes through a ring each and is written without
+ * blocking. A client too slow to keep up loses whole flushes,
+ * the time they covered is sent as one escape when there's room again.
+ *
+ * Sinks are claimed by whichever thread connects them,
+ * but only the emulator thread closes them and computes
+ * the routing, see dpyconfig().
+ */
+
+static void
+closesink(DpySink *s)
+{
+	switch(s->type) {
+	case SINK_TCP:
+		// wake up the reader
+		shutdown(s->fd, SHUT_RDWR);
+		close(s->fd);
+		free(s->ring);
+		s->ring = nil;
+		break;
+	case SINK_REC:
+		fclose(s->f);
+		break;
+	}
+	s->fd = -1;
+	s->f = nil;
+	s->closing = 0;
+	s->type = SINK_NONE;
+}
+
+static void
+dpylimits(DispCon *d)
+{
+	DpySink *s;
+
+	d->nsinks = 0;
+	d->maxcmds = DPYBUFSZ;
+	for(s = d->sink; s < &d->sink[MAXDPYSINK]; s++) {
+		if(s->type != SINK_TCP && s->type != SINK_REC)
+			continue;
+		d->nsinks++;
+		// keep v1 latency as it was
+		if(s->type == SINK_TCP && s->proto == 1)
+			d->maxcmds = 128;
+	}
+}
+
+// only called by the emulator thread
+void
+dpyconfig(PDP1 *pdp)
+{
+	DpySink *s;
+	DispCon *d;
+	int i, n, n0, n1;
+
+	pdp->dpyreconf = 0;
+	for(i = 0; i < 2; i++) {
+		d = &pdp->dpy[i];
+		for(s = d->sink; s < &d->sink[MAXDPYSINK]; s++)
+			if(s->closing)
+				closesink(s);
+		n = d->nsinks;
+		dpylimits(d);
+		if(n == 0 && d->nsinks) {
+			// start fresh
+			d->last = pdp->simtime;
+			d->lastflush = pdp->simtime;
+			d->ncmds = 0;
+		}
+	}
+
+	n0 = pdp->dpy[0].nsinks;
+	n1 = pdp->dpy[1].nsinks;
+	switch(pdp->dpymode) {
+	default:
+	case DPY_AUTO:
+		// two screens means spacewar style split
+		if(n0 && n1)
+			pdp->dpyroute = ROUTE_SPLIT;
+		else
+			pdp->dpyroute = n0 ? ROUTE_0 : n1 ? ROUTE_1 : ROUTE_NONE;
+		break;
+	case DPY_SINGLE:
+		pdp->dpyroute = n0 ? ROUTE_0 : n1 ? ROUTE_1 : ROUTE_NONE;
+		break;
+	case DPY_MIRROR:
+		if(n0 && n1)
+			pdp->dpyroute = ROUTE_MIRROR;
+		else
+			pdp->dpyroute = n0 ? ROUTE_0 : n1 ? ROUTE_1 : ROUTE_NONE;
+		break;
+	case DPY_SPLIT:
+		pdp->dpyroute = n0 || n1 ? ROUTE_SPLIT : ROUTE_NONE;
+		break;
+	}
+}
+
+static u32
+ringused(DpySink *s)
+{
+	return s->rhead - s->rtail;
+}
+
+static void
+ringput(DpySink *s, void *data, u32 n)
+{
+	u32 h = s->rhead & (DPYRINGSZ-1);
+	u32 m = DPYRINGSZ - h;
+	if(m > n)
+		m = n;
+	memcpy(s->ring+h, data, m);
+	memcpy(s->ring, (u8*)data+m, n-m);
+	s->rhead += n;
+}
+
+// write as much as the socket takes right now
+static int
+ringdrain(DpySink *s)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+	u32 t, n;
+	int m;
+
+	while((n = ringused(s)) > 0) {
+		t = s->rtail & (DPYRINGSZ-1);
+		iov[0].iov_base = s->ring+t;
+		iov[0].iov_len = n < DPYRINGSZ-t ? n : DPYRINGSZ-t;
+		iov[1].iov_base = s->ring;
+		iov[1].iov_len = n - iov[0].iov_len;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+		m = sendmsg(s->fd, &msg, MSG_DONTWAIT|MSG_NOSIGNAL);
+		if(m < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+		s->rtail += m;
+	}
+	return 0;
+}
+
+// time covered by a batch of commands in us
+static u32
+batchtime(u32 *cmds, int ncmds)
+{
+	u32 t;
+	int i;
+
+	t = 0;
+	for(i = 0; i < ncmds; i++) {
+		if((cmds[i]>>23) == 511) {
+			if(++i < ncmds)
+				t += cmds[i];
+		} else
+			t += cmds[i]>>23;
+	}
+	return t;
+}
+
+// encoded once per flush for all v2 clients with the same flags
+typedef struct Batch Batch;
+struct Batch
+{
+	u32 *cmds;
+	int ncmds;
+	int len[2];
+	u8 blk[2][DPY2_MAXBLK(DPYBUFSZ)];
+};
+
+static int
+tcpwrite(DpySink *s, Batch *b)
+{
+	u8 esc[DPY2_MAXBLK(2)];
+	u32 escw[2];
+	void *data;
+	int n, nesc, f, want, r;
+
+	if(s->proto == 1) {
+		data = b->cmds;
+		n = b->ncmds*sizeof(b->cmds[0]);
+	} else {
+		f = s->pflags & DPY2_LZ;
+		if(b->len[f] < 0)
+			b->len[f] = dpy2encode(b->cmds, b->ncmds, b->blk[f], f);
+		data = b->blk[f];
+		n = b->len[f];
+	}
+	nesc = 0;
+	if(s->lost) {
+		escw[0] = 511<<23;
+		escw[1] = s->lost;
+		if(s->proto == 1) {
+			memcpy(esc, escw, sizeof(escw));
+			nesc = sizeof(escw);
+		} else
+			nesc = dpy2encode(escw, 2, esc, 0);
+	}
+	// room for a switch too
+	if(DPYRINGSZ - ringused(s) < (u32)(nesc + n + 4)) {
+		// drop, client has to catch up first
+		s->lost += batchtime(b->cmds, b->ncmds);
+		return ringdrain(s);
+	}
+	if(nesc) {
+		ringput(s, esc, nesc);
+		s->lost = 0;
+	}
+	ringput(s, data, n);
+
+	r = 0;
+	if(s->proto == 1) {
+		// switch protocol at a flush boundary
+		want = s->want;
+		if((want&0xFF) == 2) {
+			u32 sw = DPY_SWITCH(2, want>>8 & DPY2_LZ);
+			ringput(s, &sw, 4);
+			s->proto = 2;
+			s->pflags = want>>8 & DPY2_LZ;
+			r = 1;
+		}
+	}
+	if(ringdrain(s) < 0)
+		return -1;
+	return r;
+}
+
+static int
+sinkwrite(DpySink *s, Batch *b)
+{
+	switch(s->type) {
+	case SINK_TCP:
+		return tcpwrite(s, b);
+
+	case SINK_REC:
+		// stdio does the buffering
+		if(fwrite(b->cmds, sizeof(b->cmds[0]), b->ncmds, s->f) != (size_t)b->ncmds)
+			return -1;
+		break;
+	}
+	return 0;
+}
+
+// try to get rid of client output left from earlier flushes
+static void
+drainbacklog(PDP1 *pdp, int i)
+{
+	DispCon *d = &pdp->dpy[i];
+	DpySink *s;
+
+	d->backlog = 0;
+	for(s = d->sink; s < &d->sink[MAXDPYSINK]; s++) {
+		if(s->type != SINK_TCP || s->closing)
+			continue;
+		if(ringdrain(s) < 0) {
+			s->closing = 1;
+			pdp->dpyreconf = 1;
+		} else if(ringused(s))
+			d->backlog = 1;
+	}
+}
+
+void
+flushdpy(PDP1 *pdp, int i)
+{
+	static Batch b;
+	DispCon *d = &pdp->dpy[i];
+	DpySink *s;
+	int r, changed;
+
+	b.cmds = d->cmdbuf;
+	b.ncmds = d->ncmds;
+	b.len[0] = b.len[1] = -1;
+	changed = 0;
+	d->backlog = 0;
+	for(s = d->sink; s < &d->sink[MAXDPYSINK]; s++) {
+		if((s->type != SINK_TCP && s->type != SINK_REC) || s->closing)
+			continue;
+		r = sinkwrite(s, &b);
+		if(r < 0) {
+			s->closing = 1;
+			pdp->dpyreconf = 1;
+			continue;
+		}
+		if(r > 0)
+			changed = 1;
+		if(s->type == SINK_TCP && ringused(s))
+			d->backlog = 1;
+	}
+	d->ncmds = 0;
+	d->lastflush = pdp->simtime;
+	if(changed)
+		dpylimits(d);
+}
+
+static void
+dpycmd(PDP1 *pdp, int i, u32 cmd)
+{
+	DispCon *d = &pdp->dpy[i];
+	d->cmdbuf[d->ncmds++] = cmd;
+	if(d->ncmds >= d->maxcmds)
+		flushdpy(pdp, i);
+}
+
+// escape for long delays, never split
+static void
+dpyesc(PDP1 *pdp, int i, u32 dt)
+{
+	DispCon *d = &pdp->dpy[i];
+	if(d->ncmds+2 > d->maxcmds)
+		flushdpy(pdp, i);
+	d->cmdbuf[d->ncmds++] = 511<<23;
+	d->cmdbuf[d->ncmds++] = dt;
+}
+
+// Called every main loop iteration.
+// Points go out at most once per frame period, together with an escape
+// bringing the clients up to now. Nothing is sent when nothing is shown,
+// clients age the display on their own then.
+void
+agedisplay(PDP1 *pdp, int i)
+{
+	DispCon *d = &pdp->dpy[i];
+	if(pdp->dpyreconf)
+		dpyconfig(pdp);
+	if(d->backlog)
+		drainbacklog(pdp, i);
+	if(d->ncmds == 0 || pdp->simtime - d->lastflush < DPYFRAME)
+		return;
+	assert(d->last <= pdp->simtime);
+	u64 dt = (pdp->simtime - d->last)/1000;
+	if(dt > 0) {
+		dpyesc(pdp, i, dt);
+		d->last = pdp->simtime;
+	}
+	flushdpy(pdp, i);
+}
+
+// pt has x, y and intensity already
+void
+dpyplot(PDP1 *pdp, int i, u32 pt)
+{
+	DispCon *d = &pdp->dpy[i];
+
+	assert(d->last <= pdp->simtime);
+	u64 dt = (pdp->simtime - d->last)/1000;
+	d->last = pdp->simtime;
+	// need to make sure dt field doesn't overflow cmd
+	if(dt >= 511) {
+		// TODO? theoretically dt could be huge,
+		// but if it is you have other problems
+		dpyesc(pdp, i, dt);
+		dt = 0;
+	}
+	dpycmd(pdp, i, pt | dt<<23);
+}
+
+static int
+readn(int fd, void *data, int n)
+{
+	char *p = data;
+	int m;
+
+	while(n > 0) {
+		m = read(fd, p, n);
+		if(m <= 0)
+			return -1;
+		p += m;
+		n -= m;
+	}
+	return 0;
+}
+
+typedef struct DpyReader DpyReader;
+struct DpyReader
+{
+	PDP1 *pdp;
+	DispCon *d;
+	DpySink *s;
+	int fd;
+};
+
+// handle what the display client sends us.
+// ends when the connection is closed by either side
+static void*
+dpyreader(void *arg)
+{
+	DpyReader *r = arg;
+	u32 w;
+
+	while(readn(r->fd, &w, 4) == 0) {
+		if(r->s->fd != r->fd)
+			break;
+		switch(w>>24) {
+		case 0xFE:	// protocol hello
+			r->s->want = w & 0xFFFF;
+			break;
+		case DPY_PEN:
+			r->d->pen = w;
+			break;
+		}
+	}
+	// the client went away, a sink that isn't written to wouldn't notice
+	if(r->s->fd == r->fd) {
+		r->s->closing = 1;
+		r->pdp->dpyreconf = 1;
+	}
+	free(r);
+	return nil;
+}
+
+// grab a free sink, any thread
+static DpySink*
+claimsink(DispCon *d)
+{
+	DpySink *s;
+
+	for(s = d->sink; s < &d->sink[MAXDPYSINK]; s++)
+		if(__sync_bool_compare_and_swap(&s->type, SINK_NONE, SINK_CLAIMED))
+			return s;
+	return nil;
+}
+
+// add a display client, returns -1 if there are too many
+int
+connectdpy(PDP1 *pdp, int i, int fd)
+{
+	DispCon *d = &pdp->dpy[i];
+	pthread_t th;
+	DpyReader *r;
+	DpySink *s;
+
+	if((s = claimsink(d)) == nil)
+		return -1;
+	s->fd = fd;
+	s->f = nil;
+	s->ring = malloc(DPYRINGSZ);
+	s->rhead = s->rtail = 0;
+	s->lost = 0;
+	s->proto = 1;
+	s->pflags = 0;
+	s->want = 0;
+	s->closing = 0;
+	nodelay(fd);
+
+	r = malloc(sizeof(DpyReader));
+	r->pdp = pdp;
+	r->d = d;
+	r->s = s;
+	r->fd = fd;
+	pthread_create(&th, nil, dpyreader, r);
+	pthread_detach(th);
+
+	s->type = SINK_TCP;
+	pdp->dpyreconf = 1;
+	return 0;
+}
+
+// record screen i to a file
+int
+recorddpy(PDP1 *pdp, int i, FILE *f)
+{
+	DpySink *s;
+
+	if((s = claimsink(&pdp->dpy[i])) == nil)
+		return -1;
+	s->fd = -1;
+	s->f = f;
+	s->closing = 0;
+	s->type = SINK_REC;
+	pdp->dpyreconf = 1;
+	return 0;
+}
+
+// have the emulator close all sinks of a type
+void
+disconnectdpy(PDP1 *pdp, int i, int type)
+{
+	DpySink *s;
+
+	for(s = pdp->dpy[i].sink; s < &pdp->dpy[i].sink[MAXDPYSINK]; s++)
+		if(s->type == type)
+			s->closing = 1;
+	pdp->dpyreconf = 1;
+}
+
+void
+initdpys(PDP1 *pdp)
+{
+	int i;
+
+	for(i = 0; i < 2; i++) {
+		pdp->dpy[i].last = pdp->simtime;
+		pdp->dpy[i].lastflush = pdp->simtime;
+		pdp->dpy[i].ncmds = 0;
+	}
+	pdp->dpyreconf = 1;
+}
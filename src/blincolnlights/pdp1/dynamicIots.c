@@ -1,8 +1,10 @@
 /**
  * This implements dynamic loading and execution of custom IOT commands for the pidp-1.
- * When an unknown IOT is seen by the emulator, this will search for a handler compilied as a shared object.
- * The file must be named 'IOT_nn.so', where nn is the OCTAL IOT device number.
- * If found, it is registered and then used to handle the IOT.
+ * At startup all handlers compiled as shared objects are loaded from the IOT directory, /opt/pidp1/IOTs
+ * unless the emulator is given -i dir. If the directory has a manifest file IOTs.conf, only the handlers
+ * listed in it are loaded, one per line as 'nn [file]'. Otherwise every file named 'IOT_nn.so' is,
+ * where nn is the OCTAL IOT device number. Each is checked and then used to handle the IOT,
+ * so nothing is loaded while a program runs. 'iot reload [nn]' replaces one or all between cycles.
  *
  * The handler will be called twice for every IOT instruction for it, once at the start of IOT 'hardware' pulse,
  * again at the end of the pulse.
@@ -17,27 +19,58 @@
  * void iotStop(void); - called when the emulator transitions to halt state
  *
  * Pseudo-asynchronous behavior can be done by implementing:
- * void iotEnablePoll(int) - 1 to enable polling, 0 to disable, but only if an isPoll() is implemented
- * void iotPoll(void); -called every instruction cycle if enabled
+ * void iotPoll(PDP1 *); - called between instruction cycles when the IOT asked for it with
+ * pollAt(simtime), pollEvery(ns), pollOnFd(fd) or the old enablePolling(cycles), see iotHandler.h.
+ * The deadlines are kept here, the emulator only compares simtime against the earliest one,
+ * so a loaded IOT costs nothing per cycle while it has nothing due.
+ *
+ * Host I/O that could block goes to submitJob(work, done, arg, when). work(arg) runs on a worker thread,
+ * done(pdp, arg) on the emulator thread between cycles, where it can set ios, cksflags or request a break.
  */
 
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <dlfcn.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 
 #include "common.h"
 #include "pdp1.h"
 #define NOTIOTH
 #include "dynamicIots.h"
+#include "highSpeedChannels.h"
 
 static int stopped = 1;         // assume we are halted initially
 static IotEntry handles[64];
 static PollEntryP pollList;
+u64 dynamicIotNextPoll = NEVER;
+static char iotDir[256] = "/opt/pidp1/IOTs";
+
+// Worker threads for host I/O, an IOT always uses the same one so its jobs run in order.
+#define NUM_WORKERS 2
+typedef struct worker
+{
+    pthread_t thread;
+    JobEntryP headP, *tailPP;
+} Worker;
+static Worker workers[NUM_WORKERS];
+static pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t jobDone = PTHREAD_COND_INITIALIZER;
+static FD jobFd = { .fd = -1 }; // eventfd, readable when a job finished
+static JobEntryP jobList;       // submitted, not yet delivered
+static JobEntryP *jobTailPP = &jobList;
+static int jobsDone;            // jobFd fired
+#define MANIFEST "IOTs.conf"
 
 extern PDP1 *visiblePDP1P;      // from main.c
 extern void dynamicReq(PDP1 *pdp, int chan);
 
 void dynamicIotProcessBreak(int chan);
-static IotEntryP initializeEntry(int dev);
+static IotEntryP initializeEntry(int dev, const char *fileP);
+static void updateNextPoll(void);
+static void deliverJobs(PDP1 *pdp1P, IotEntryP entryP);
 
 // Called from the emulator to try to invoke a dynamic IOT.
 // It is called twice for each IOT, once on the IOT start pulse rising edge, once on the falling edge.
@@ -62,27 +95,21 @@ int status;
         entryP = entryP->actualEntryP;
     }
 
-    if( entryP->invalid )       // been here before, nothing
+    if( entryP->invalid || !entryP->handlerP )  // nothing was loaded for it
     {
         return(0);
     }
-    else if( !entryP->dlHandleP )    // it hasn't been resolved yet
-    {
-        if( !(entryP = initializeEntry(dev)) )
-        {
-            return(0);
-        }
-    }
 
     stopped = 0;
     status = entryP->handlerP(pdpP, dev, pulse, completion);
     return( status );
 }
 
+// Any thread, see postbreak().
 void
 dynamicIotProcessBreak(int chan)
 {
-    if( chan < 16)
+    if( (chan >= 0) && (chan < 16) )
     {
         dynamicReq(visiblePDP1P, chan);               // signal a break, convoluted because of various unshared bits
     }
@@ -100,7 +127,7 @@ IotStartP startP;
         return;             // already done
     }
 
-    for( i = 0; i < 65; ++i )
+    for( i = 0; i < 64; ++i )
     {
         if( (startP = handles[i].startP) && !handles[i].isAlias )
         {
@@ -123,7 +150,7 @@ IotStopP stopP;
         return;             // already done
     }
 
-    for( i = 0; i < 65; ++i )
+    for( i = 0; i < 64; ++i )
     {
         if( (stopP = handles[i].stopP) && !handles[i].isAlias )
         {
@@ -134,87 +161,352 @@ IotStopP stopP;
     stopped = 1;
 }
 
-// Called every instruction cycle to hande any IOTs with polling.
+// Find the earliest deadline again.
+static void
+updateNextPoll(void)
+{
+PollEntryP pollItemP;
+JobEntryP jobP;
+u64 next, seen, bit;
+
+    next = NEVER;
+    for( pollItemP = pollList; pollItemP; pollItemP = pollItemP->nextP )
+    {
+        if( pollItemP->fdReady )
+        {
+            next = 0;
+        }
+        else if( pollItemP->due < next )
+        {
+            next = pollItemP->due;
+        }
+    }
+
+    if( jobsDone )
+    {
+        next = 0;
+    }
+
+    // only an IOT's oldest job can be delivered, the others wait for it
+    seen = 0;
+    for( jobP = jobList; jobP; jobP = jobP->nextP )
+    {
+        bit = (u64)1 << (jobP->iotEntryP - handles);
+        if( jobP->when && !(seen & bit) && (jobP->when < next) )
+        {
+            next = jobP->when;
+        }
+        seen |= bit;
+    }
+
+    dynamicIotNextPoll = next;
+}
+
+// Called from cycle() when the earliest deadline is due or a watched fd is ready.
 void
 dynamicIotProcessorDoPoll(PDP1 *pdp1P)
 {
-IotEntryP entryP;
 PollEntryP pollItemP;
+int ready;
 
     if( stopped )
     {
         return;             // nothing to do
     }
 
-    // go thru the chain calling any that is enabled and has reached its cycle count
+    // go thru the chain calling any that are due, then reschedule them
     for( pollItemP = pollList; pollItemP; pollItemP = pollItemP->nextP )
     {
-        entryP = pollItemP-> iotEntryP;
-        if( entryP->pollEnabled )
+        ready = pollItemP->fdReady;
+        if( !ready && (pollItemP->due > pdp1P->simtime) )
         {
-            if( ++(pollItemP->curCount) >= entryP->pollEnabled )
-            {
-                pollItemP->curCount = 0;
-                entryP->pollP(pdp1P);
-            }
+            continue;
         }
+
+        if( pollItemP->due <= pdp1P->simtime )
+        {
+            // from now, a halt shouldn't cause a burst of catch-up calls
+            pollItemP->due = pollItemP->period ? pdp1P->simtime + pollItemP->period : (u64)NEVER;
+        }
+
+        pollItemP->fdReady = 0;
+        pollItemP->iotEntryP->pollP(pdp1P);
+
+        if( ready && (pollItemP->fd.fd >= 0) )
+        {
+            rearmfd(&pollItemP->fd);        // one call per readiness
+        }
+    }
+
+    if( jobList )
+    {
+        deliverJobs(pdp1P, 0);
     }
+
+    updateNextPoll();
 }
 
-static IotEntryP
-initializeEntry(int dev)
+void
+dynamicIotSetPoll(void *cbP, u64 when, u64 period)
+{
+PollEntryP pollItemP;
+
+    if( !(pollItemP = ((IotEntryP)cbP)->pollEntryP) )
+    {
+        return;             // no iotPoll(), nothing to call
+    }
+
+    // the same period again leaves the running schedule alone
+    if( period && (period == pollItemP->period) && (pollItemP->due != (u64)NEVER) )
+    {
+        return;
+    }
+
+    pollItemP->due = when;
+    pollItemP->period = period;
+    updateNextPoll();
+}
+
+void
+dynamicIotPollEvery(void *cbP, u64 ns)
+{
+    if( ns )
+    {
+        dynamicIotSetPoll(cbP, visiblePDP1P->simtime + ns, ns);
+    }
+    else
+    {
+        dynamicIotSetPoll(cbP, NEVER, 0);
+    }
+}
+
+static void
+pollFdReady(FD *fdP)
+{
+    ((PollEntryP)fdP->arg)->fdReady = 1;
+    dynamicIotNextPoll = 0;
+}
+
+void
+dynamicIotSetPollFd(void *cbP, int fd)
+{
+PollEntryP pollItemP;
+
+    if( !(pollItemP = ((IotEntryP)cbP)->pollEntryP) )
+    {
+        return;
+    }
+
+    if( pollItemP->fd.fd >= 0 )
+    {
+        unwatchfd(&pollItemP->fd);
+    }
+
+    pollItemP->fdReady = 0;
+    pollItemP->fd.fd = fd;
+    if( fd >= 0 )
+    {
+        pollItemP->fd.ready = pollFdReady;
+        pollItemP->fd.arg = pollItemP;
+        waitfd(&pollItemP->fd);
+    }
+
+    updateNextPoll();
+}
+
+static void *
+workerThread(void *argP)
+{
+Worker *workerP = argP;
+JobEntryP jobP;
+u64 one = 1;
+
+    pthread_mutex_lock(&jobLock);
+    for( ;; )
+    {
+        while( !(jobP = workerP->headP) )
+        {
+            pthread_cond_wait(&jobQueued, &jobLock);
+        }
+
+        if( !(workerP->headP = jobP->workNextP) )
+        {
+            workerP->tailPP = &workerP->headP;
+        }
+
+        pthread_mutex_unlock(&jobLock);
+        jobP->workP(jobP->argP);
+        pthread_mutex_lock(&jobLock);
+
+        jobP->done = 1;
+        pthread_cond_broadcast(&jobDone);
+        write(jobFd.fd, &one, sizeof(one));
+    }
+
+    return(0);
+}
+
+// A worker finished something, runs on the emulator thread from pollfds().
+static void
+jobFdReady(FD *fdP)
+{
+u64 n;
+
+    read(fdP->fd, &n, sizeof(n));
+    rearmfd(fdP);
+    jobsDone = 1;
+    dynamicIotNextPoll = 0;
+}
+
+static int
+startWorkers(void)
 {
 int i;
-IotEntryP entryP, tmpEntryP;
+
+    if( (jobFd.fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0 )
+    {
+        return(-1);
+    }
+
+    jobFd.ready = jobFdReady;
+    waitfd(&jobFd);
+
+    for( i = 0; i < NUM_WORKERS; ++i )
+    {
+        workers[i].tailPP = &workers[i].headP;
+        pthread_create(&workers[i].thread, 0, workerThread, &workers[i]);
+    }
+
+    return(0);
+}
+
+int
+dynamicIotSubmit(void *cbP, IotJobP workP, IotJobDoneP doneP, void *argP, u64 when)
+{
+JobEntryP jobP;
+Worker *workerP;
+
+    if( (jobFd.fd < 0) && (startWorkers() < 0) )
+    {
+        return(-1);
+    }
+
+    jobP = (JobEntryP)calloc(1, sizeof(JobEntry));
+    jobP->iotEntryP = (IotEntryP)cbP;
+    jobP->workP = workP;
+    jobP->doneP = doneP;
+    jobP->argP = argP;
+    jobP->when = when;
+
+    *jobTailPP = jobP;
+    jobTailPP = &jobP->nextP;
+
+    workerP = &workers[(jobP->iotEntryP - handles) % NUM_WORKERS];
+    pthread_mutex_lock(&jobLock);
+    *workerP->tailPP = jobP;
+    workerP->tailPP = &jobP->workNextP;
+    pthread_cond_broadcast(&jobQueued);
+    pthread_mutex_unlock(&jobLock);
+
+    updateNextPoll();
+    return(0);
+}
+
+// Hand finished jobs back to their IOTs, in the order they were submitted.
+// A job whose simtime has come but isn't done yet is waited for. Once one job of an IOT has to stay,
+// its later jobs stay too, even if they are done.
+// If entryP is set, all of that IOT's jobs are finished now, it's being unloaded.
+static void
+deliverJobs(PDP1 *pdp1P, IotEntryP entryP)
+{
+JobEntryP jobP, *jobPP;
+u64 blocked, bit;
+
+    jobsDone = 0;
+    blocked = 0;
+    for( jobPP = &jobList; (jobP = *jobPP); )
+    {
+        bit = (u64)1 << (jobP->iotEntryP - handles);
+        if( entryP ? (jobP->iotEntryP != entryP) : ((blocked & bit) || (jobP->when > pdp1P->simtime)) )
+        {
+            blocked |= bit;
+            jobPP = &jobP->nextP;
+            continue;
+        }
+
+        pthread_mutex_lock(&jobLock);
+        if( !jobP->done && !jobP->when && !entryP )
+        {
+            pthread_mutex_unlock(&jobLock);
+            blocked |= bit;
+            jobPP = &jobP->nextP;
+            continue;           // no deadline, wait for the worker to tell us
+        }
+
+        while( !jobP->done )
+        {
+            pthread_cond_wait(&jobDone, &jobLock);
+        }
+        pthread_mutex_unlock(&jobLock);
+
+        if( !(*jobPP = jobP->nextP) )
+        {
+            jobTailPP = jobPP;
+        }
+
+        if( jobP->doneP )
+        {
+            jobP->doneP(pdp1P, jobP->argP);
+        }
+        free(jobP);
+    }
+}
+
+// Load one handler, no aliases resolved yet. Returns 0 and says why if it isn't usable.
+static IotEntryP
+initializeEntry(int dev, const char *fileP)
+{
+IotEntryP entryP;
 PollEntryP pollEntryP;
 IotAliasP aliasP;
-char fname[256];
+char fname[512];
 
     entryP = &handles[dev];
 
-    sprintf(fname,"/opt/pidp1/IOTs/IOT_%2o.so", dev);
+    if( fileP[0] == '/' )
+    {
+        snprintf(fname, sizeof(fname), "%s", fileP);
+    }
+    else
+    {
+        snprintf(fname, sizeof(fname), "%s/%s", iotDir, fileP);
+    }
 
-    if( !(entryP->dlHandleP = dlopen(fname, RTLD_LAZY)) )
+    if( !(entryP->dlHandleP = dlopen(fname, RTLD_NOW)) )
     {
-        // Not found, record that and fail
+        // Not found or unresolved symbols, record that and fail
+        fprintf(stderr, "IOT %02o: %s\n", dev, dlerror());
         entryP->invalid = 1;
         return(0);
     }
 
+    entryP->fileP = strdup(fname);
     entryP->handlerP = (IotHandlerP)dlsym(entryP->dlHandleP, "iotHandler");
     if( !entryP->handlerP )
     {
-        // It could be an alias
+        // It could be an alias, resolved once everything is loaded
         if( (aliasP = (IotAliasP)dlsym(entryP->dlHandleP, "iotAlias")) )
         {
-            // we need to have this alias point to the real one
-            i = aliasP();
-            if( (i < 1) && (i > 63) )
-            {
-                return(0);      // out of range
-            }
-
-            tmpEntryP = &handles[i];    // our real entry
-            if( !tmpEntryP->handlerP )
-            {
-                tmpEntryP = initializeEntry(i);
-            }
-
-            if( !tmpEntryP )
-            {
-                return(0);              // target doesn't exist
-            }
-
+            entryP->aliasOf = aliasP();
             entryP->isAlias = 1;
-            entryP->actualEntryP = tmpEntryP;
-            return( tmpEntryP );
-        }
-        else
-        {
-            dlclose(entryP->dlHandleP);
-            entryP->invalid = 1;
-            return(0);
+            return( entryP );
         }
+
+        fprintf(stderr, "IOT %02o: %s has neither iotHandler() nor iotAlias()\n", dev, fname);
+        dlclose(entryP->dlHandleP);
+        entryP->dlHandleP = 0;
+        entryP->invalid = 1;
+        return(0);
     }
 
     // Should be implemented, but if not, ignore
@@ -231,18 +523,308 @@ char fname[256];
     entryP->pollP = (IotPollP)dlsym(entryP->dlHandleP, "iotPoll");
     if( entryP->pollP )
     {
-        pollEntryP = (PollEntryP)malloc(sizeof(PollEntry));
+        if( !setterP )
+        {
+            fprintf(stderr, "IOT %02o: %s has iotPoll() but was not built with iotHandler.h, it won't be polled\n",
+                dev, fname);
+        }
+
+        pollEntryP = (PollEntryP)calloc(1, sizeof(PollEntry));
         pollEntryP->iotEntryP = entryP;
+        pollEntryP->due = NEVER;
+        pollEntryP->fd.fd = -1;
         pollEntryP->nextP = pollList;
         pollList = pollEntryP;
+        entryP->pollEntryP = pollEntryP;
     }
 
-    // Be sure start gets called, we're already running so it won't have been yet.
-    if( entryP->startP )
+    return( entryP );
+}
+
+// Point an alias at its target, which must be a real handler by now.
+static void
+resolveAlias(int dev)
+{
+IotEntryP entryP, targetP;
+int i;
+
+    entryP = &handles[dev];
+    i = entryP->aliasOf;
+    targetP = &handles[i & 077];
+
+    if( (i < 1) || (i > 077) || (i == dev) )
+    {
+        fprintf(stderr, "IOT %02o: alias target %o out of range\n", dev, i);
+    }
+    else if( targetP->isAlias || !targetP->handlerP )
+    {
+        fprintf(stderr, "IOT %02o: alias target %02o is not loaded\n", dev, i);
+    }
+    else
     {
-        stopped = 0;
-        entryP->startP();
+        entryP->actualEntryP = targetP;
+        return;
     }
 
-    return( entryP );
+    dlclose(entryP->dlHandleP);
+    free(entryP->fileP);
+    memset(entryP, 0, sizeof(*entryP));
+    entryP->invalid = 1;
+}
+
+// Drop a handler, stopping it first if we're running.
+static void
+unloadEntry(int dev)
+{
+IotEntryP entryP;
+PollEntryP *pollItemPP, pollItemP;
+Dl_info info;
+
+    entryP = &handles[dev];
+
+    if( entryP->dlHandleP && !entryP->isAlias )
+    {
+        deliverJobs(visiblePDP1P, entryP);     // its code is about to go away
+
+        // and so do its transfer descriptors and buffers
+        if( entryP->handlerP && dladdr((void *)entryP->handlerP, &info) )
+        {
+            HSC_cancel(visiblePDP1P, info.dli_fbase);
+        }
+
+        if( !stopped && entryP->stopP )
+        {
+            entryP->stopP();
+        }
+
+        for( pollItemPP = &pollList; (pollItemP = *pollItemPP); pollItemPP = &pollItemP->nextP )
+        {
+            if( pollItemP->iotEntryP == entryP )
+            {
+                if( pollItemP->fd.fd >= 0 )
+                {
+                    unwatchfd(&pollItemP->fd);
+                }
+
+                *pollItemPP = pollItemP->nextP;
+                free(pollItemP);
+                break;
+            }
+        }
+
+        updateNextPoll();
+    }
+
+    if( entryP->dlHandleP )
+    {
+        dlclose(entryP->dlHandleP);
+    }
+
+    free(entryP->fileP);
+    memset(entryP, 0, sizeof(*entryP));
+}
+
+// Load everything named in the manifest, or every IOT_nn.so in the directory.
+static int
+loadDir(void)
+{
+FILE *fP;
+DIR *dirP;
+struct dirent *dP;
+char line[512], file[256];
+int dev, n, count, i;
+
+    count = 0;
+    snprintf(line, sizeof(line), "%s/%s", iotDir, MANIFEST);
+
+    if( (fP = fopen(line, "r")) )
+    {
+        while( fgets(line, sizeof(line), fP) )
+        {
+            if( (line[0] == '#') || ((n = sscanf(line, "%o %255s", &dev, file)) < 1) )
+            {
+                continue;               // comment or empty
+            }
+
+            if( (dev < 1) || (dev > 077) )
+            {
+                fprintf(stderr, "%s/%s: bad IOT number %o\n", iotDir, MANIFEST, dev);
+                continue;
+            }
+
+            if( n == 1 )
+            {
+                sprintf(file, "IOT_%02o.so", dev);
+            }
+
+            if( handles[dev].dlHandleP )
+            {
+                fprintf(stderr, "IOT %02o: listed twice, keeping %s\n", dev, handles[dev].fileP);
+            }
+            else if( initializeEntry(dev, file) )
+            {
+                ++count;
+            }
+        }
+
+        fclose(fP);
+    }
+    else if( (dirP = opendir(iotDir)) )
+    {
+        while( (dP = readdir(dirP)) )
+        {
+            // older builds wrote 'IOT_ 7.so', %o takes that too
+            n = 0;
+            if( (sscanf(dP->d_name, "IOT_%o.so%n", &dev, &n) < 1) || (n == 0) || dP->d_name[n] )
+            {
+                continue;
+            }
+
+            if( (dev < 1) || (dev > 077) || handles[dev].dlHandleP )
+            {
+                continue;
+            }
+
+            if( initializeEntry(dev, dP->d_name) )
+            {
+                ++count;
+            }
+        }
+
+        closedir(dirP);
+    }
+
+    for( i = 1; i < 64; ++i )
+    {
+        if( handles[i].isAlias && !handles[i].actualEntryP )
+        {
+            resolveAlias(i);
+            if( handles[i].invalid )
+            {
+                --count;
+            }
+        }
+    }
+
+    return( count );
+}
+
+// Called at startup, before anything runs. dirP, if not 0, replaces the IOT directory.
+// Returns how many handlers were loaded.
+int
+dynamicIotLoadAll(const char *dirP)
+{
+    if( dirP )
+    {
+        snprintf(iotDir, sizeof(iotDir), "%s", dirP);
+    }
+
+    return( loadDir() );
+}
+
+// Replace the handler for dev, or all of them if dev is -1, with what's on disk now.
+// Runs between cycles, a running handler gets iotStop() and the new one iotStart().
+void
+dynamicIotReload(int dev, char *respP, int len)
+{
+char file[512];
+IotEntryP entryP;
+int i, n;
+
+    if( dev < 0 )
+    {
+        for( i = 1; i < 64; ++i )
+        {
+            unloadEntry(i);
+        }
+
+        n = loadDir();
+    }
+    else if( (dev < 1) || (dev > 077) )
+    {
+        snprintf(respP, len, "bad IOT number %o", dev);
+        return;
+    }
+    else
+    {
+        if( handles[dev].fileP )
+        {
+            snprintf(file, sizeof(file), "%s", handles[dev].fileP);
+        }
+        else
+        {
+            sprintf(file, "IOT_%02o.so", dev);
+        }
+
+        unloadEntry(dev);
+
+        // aliases of us are pointing at nothing until we're back
+        n = 0;
+        if( (entryP = initializeEntry(dev, file)) )
+        {
+            n = 1;
+            if( entryP->isAlias )
+            {
+                resolveAlias(dev);
+                n = !handles[dev].invalid;
+            }
+        }
+
+        for( i = 1; i < 64; ++i )
+        {
+            if( handles[i].actualEntryP == &handles[dev] && !handles[dev].handlerP )
+            {
+                unloadEntry(i);
+                handles[i].invalid = 1;
+            }
+        }
+    }
+
+    if( !stopped )
+    {
+        for( i = (dev < 0) ? 1 : dev; i < ((dev < 0) ? 64 : dev + 1); ++i )
+        {
+            if( handles[i].startP && !handles[i].isAlias )
+            {
+                handles[i].startP();
+            }
+        }
+    }
+
+    if( dev < 0 )
+    {
+        snprintf(respP, len, "%d IOTs loaded from %s", n, iotDir);
+    }
+    else
+    {
+        snprintf(respP, len, n ? "IOT %02o reloaded" : "IOT %02o not loaded, see the emulator's stderr", dev);
+    }
+}
+
+// What's loaded, one line per IOT.
+void
+dynamicIotList(char *respP, int len)
+{
+IotEntryP entryP;
+int i, n;
+
+    n = snprintf(respP, len, "IOTs from %s", iotDir);
+    for( i = 1; (i < 64) && (n < len); ++i )
+    {
+        entryP = &handles[i];
+        if( !entryP->dlHandleP )
+        {
+            continue;
+        }
+
+        if( entryP->isAlias )
+        {
+            n += snprintf(respP + n, len - n, "\n%02o -> %02o  %s", i, entryP->aliasOf, entryP->fileP);
+        }
+        else
+        {
+            n += snprintf(respP + n, len - n, "\n%02o %s%s%s  %s", i,
+                entryP->startP ? "s" : "-", entryP->stopP ? "s" : "-", entryP->pollP ? "p" : "-", entryP->fileP);
+        }
+    }
 }
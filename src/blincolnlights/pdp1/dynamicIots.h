@@ -7,10 +7,27 @@ void dynamicIotProcessorStart(void);
 void dynamicIotProcessorStop(void);
 void dynamicIotProcessorSetPDP1(PDP1 *pdpP);
 void dynamicIotProcessorDoPoll(PDP1 *pdpP);
+extern u64 dynamicIotNextPoll;      // simtime when dynamicIotProcessorDoPoll() has something to do
+int dynamicIotLoadAll(const char *dirP);
+void dynamicIotReload(int dev, char *respP, int len);
+void dynamicIotList(char *respP, int len);
 #endif
 
-// Called from an implemented handler
-void dynamicIotSetPollingState(void *, int); // really gets called with a pointer to the control block for the IOT
+// Called from an implemented handler, with a pointer to the control block for the IOT.
+// Poll at simtime 'when', then every 'period' ns if not 0. NEVER for 'when' stops polling.
+void dynamicIotSetPoll(void *, u64 when, u64 period);
+// Poll every 'ns' from now, 0 to stop.
+void dynamicIotPollEvery(void *, u64 ns);
+// Poll when fd is readable, -1 to stop.
+void dynamicIotSetPollFd(void *, int fd);
+
+// Host I/O that may block, run on a worker thread. It must not touch the PDP1.
+typedef void (*IotJobP)(void *);
+// Called on the emulator thread between cycles when the job is done and simtime has reached 'when'.
+typedef void (*IotJobDoneP)(PDP1 *, void *);
+// Queue a job, jobs of one IOT run in order. when is 0 for as soon as it's done, otherwise the emulator
+// waits for the job at that simtime if it's still running, so simulated timing doesn't depend on the host.
+int dynamicIotSubmit(void *, IotJobP workP, IotJobDoneP doneP, void *argP, u64 when);
 
 // What a loadable IOT handler implements, PDP1 state, pulse hi/low, completion pulse wanted
 // The IOT handler implements a function 'int iotHandler(PDP1 *pdp1P, int device, int pulse, int completion)'.
@@ -29,8 +46,8 @@ typedef void (*IotStopP)(void);
 // If implemented, will duplicate this IOT into the IOT number returned.
 typedef int (*IotAliasP)();
 
-// These two are implemented if the handler is to get poll calls from the emulator once per instruction cycle
-typedef void (*IotPollEnableP)(int);
+// Implemented if the handler is to get poll calls from the emulator.
+// It is only called when a deadline set with pollAt()/pollEvery() is due or a watched fd is readable.
 typedef void (*IotPollP)(PDP1 *);
 
 // Additionally, a 'hidden' callback is set up to allow the handler to initiate a sequence break
@@ -42,7 +59,9 @@ typedef struct _IotEntry
 {
     int invalid;        // if 1, we tried to load already, nothing found
     int isAlias;        // if 1, we are a copy
-    int pollEnabled;    // 0, no polling, the default
+    int aliasOf;        // the IOT we are a copy of, while loading
+    char *fileP;        // where we were loaded from
+    struct pollEntry *pollEntryP;   // 0 if no iotPoll()
     void *dlHandleP;
     IotHandlerP handlerP;
     IotStartP startP;
@@ -56,10 +75,24 @@ typedef struct pollEntry
 {
     struct pollEntry *nextP;         // we link all polls in a chain
     IotEntryP iotEntryP;            // the definition for a given IOT
-    int numCycles;                  // if not 0, how many cycles between calls
-    int curCount;                   // cycles since last entry call
+    u64 due;                        // simtime of the next call, NEVER if none
+    u64 period;                     // if not 0, ns between calls
+    FD fd;                          // watched fd, if fd.fd >= 0
+    int fdReady;                    // fd became readable
 } PollEntry, *PollEntryP;
 
+typedef struct jobEntry
+{
+    struct jobEntry *nextP;         // in submission order, emulator thread only
+    struct jobEntry *workNextP;     // on a worker's queue
+    IotEntryP iotEntryP;
+    IotJobP workP;
+    IotJobDoneP doneP;
+    void *argP;
+    u64 when;
+    int done;                       // set by the worker
+} JobEntry, *JobEntryP;
+
 // Similarly, set a reference back to the IotEntry for an IOT
 typedef void (*IotControlBlockSetterP)(IotEntryP);
 #endif
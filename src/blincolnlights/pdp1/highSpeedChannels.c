@@ -2,12 +2,16 @@
  * This is a loose implementation of the Type 19 High Speed Channel Control.
  * It is for use in IOTs or other emulator code to package up direct memory access
  * and simulate the behavior of the PDP-1 dma, hiding details of memory back wraparound, etc.
- * It does one read/write operation every run cycle, 5us.
- * This isn't strictly correct, the actual hardware did a cycle-steal for each, adding 5us to the instruction
- * cycle time, but this will do for now.
+ * Like the hardware, every word moved steals one 5us memory cycle from the processor.
+ * Normally that is one word after every processor cycle, so instructions take twice as long while a transfer runs.
+ * In STEAL mode the channel keeps the processor off memory until it's done. Nothing can look at memory meanwhile,
+ * so the whole block is copied at once and simtime advanced by the cycles it took.
 */
 
+#define _GNU_SOURCE
 #include <unistd.h>
+#include <string.h>
+#include <dlfcn.h>
 
 // #define DOLOGGING
 #include "common.h"
@@ -22,26 +26,50 @@ static HSC_Control chan3;
 
 static HSC_ControlP HSC_chans[] = {&chan1, &chan2, &chan3};
 
-static void processChannel(PDP1 *pdp1P, HSC_ControlP controlP);
-static void processImmediate(PDP1 *pdp1P, int mode, int count, int memBank, int memAddr,
-    Word *toBufferP, Word *fromBufferP);
+int HSC_active;         // busy channels, so the run loop only calls us when there's something to do
 
-// Service routine called from run loop. Question - did the hardware pause on a halt, or complete?
-// Returns 0 if it took no action, 1 if it did a 'memory cycle' and we are in steal mode.
+static int checkDesc(HSC_DescP descP);
+static void startDesc(HSC_ControlP controlP);
+static int transferWords(PDP1 *pdp1P, HSC_ControlP controlP, int count);
+static void finishDesc(PDP1 *pdp1P, HSC_ControlP controlP);
+static void idleChannel(PDP1 *pdp1P, HSC_ControlP controlP);
+static int queueDesc(int chan, HSC_DescP descP, void *callerP);
+
+// Service routine called from run loop before each instruction cycle.
+// Only the highest priority busy channel transfers, the others wait for it to complete.
+// Returns the number of memory cycles stolen from the processor.
 int
 processHSChannels(PDP1 *pdp1P)
 {
 int i;
+int steal, stolen;
 HSC_ControlP controlP;
 
     // we do in priority order, 0 being highest
-    for( i = 0; controlP = HSC_chans[i++]; i < 3 )
+    for( i = 0; i < 3; ++i )
     {
-        if( controlP->status == HSC_BUSY )
+        controlP = HSC_chans[i];
+        if( controlP->status != HSC_BUSY )
         {
-            processChannel(pdp1P, controlP);
-            return( !!(controlP->mode & HSC_MODE_STEAL) );        // we processed one, maybe steal, maybe not
+            continue;
         }
+
+        pdp1P->hsc = 1;      // be sure our in-use light is on
+
+        // the processor is held off for the whole block, do it in one go, and any STEAL ones chained to it
+        stolen = 0;
+        do
+        {
+            steal = controlP->headP->mode & HSC_MODE_STEAL;
+            stolen += transferWords(pdp1P, controlP, steal ? controlP->count : 1);
+
+            if( controlP->count <= 0 )
+            {
+                finishDesc(pdp1P, controlP);
+            }
+        } while( steal && controlP->headP && (controlP->headP->mode & HSC_MODE_STEAL) );
+
+        return( stolen );
     }
 
     return(0);
@@ -61,25 +89,32 @@ HSC_request_channel(
     Word *fromBufferP)   // the user buffer to copy memory into, should be 4096 words
 {
 HSC_ControlP controlP;
+HSC_Desc desc;
+HSC_Control immediate;
 
     if( (chan < 1) || (chan > 3) )
     {
         return( HSC_ERR );
     }
-    
-    if( (memBank > 15) || (memBank > 15) || (memAddr > 4095) || (memAddr > 4095) || (count > 4096))
+
+    memset(&desc, 0, sizeof(desc));
+    desc.mode = mode & ~HSC_MODE_IMMEDIATE;
+    desc.count = count;
+    desc.memBank = memBank;
+    desc.memAddr = memAddr;
+    desc.toBufP = toBufferP;
+    desc.fromBufP = fromBufferP;
+
+    if( checkDesc(&desc) != HSC_OK )
     {
         return( HSC_ERR );
     }
 
-    if( !(mode & 0x3) )
-    {
-        return( HSC_ERR );      // no from or to, nothing to do
-    } 
-
     if( mode & HSC_MODE_IMMEDIATE )     // do it now, no -1 timing emulation, don't care if busy
     {
-        processImmediate(pdp1P, mode, count, memBank, memAddr, toBufferP, fromBufferP);
+        immediate.headP = &desc;
+        startDesc(&immediate);
+        transferWords(pdp1P, &immediate, count);
         return( HSC_OK );
     }
 
@@ -90,53 +125,114 @@ HSC_ControlP controlP;
         return( HSC_BUSY );
     }
 
-    // Ok, chan is free, set it up and go.
-    controlP->mode = mode;
-    controlP->count = count;
-    controlP->memBank = memBank;
-    controlP->memAddr = memAddr;
-    controlP->toBufP = toBufferP;
-    controlP->fromBufP = fromBufferP;
+    // Ok, chan is free, set it up and go. 0 words completes on the next cycle.
+    controlP->single = desc;
+    return( queueDesc(chan, &controlP->single, __builtin_return_address(0)) );
+}
 
-    controlP->status = HSC_BUSY;
-    logger("channel %d set to BUSY\n", chan);
-    return( HSC_OK );
+int
+HSC_queue(PDP1 *pdp1P, int chan, HSC_DescP descP)
+{
+    return( queueDesc(chan, descP, __builtin_return_address(0)) );
 }
 
-static void
-processImmediate(
-    PDP1 *pdp1P,        // emulator context
-    int mode,           // HSC_MODE_FROMMEM, _TOMEM, _IMMEDIATE (or'd together)
-    int count,          // number of words to transfer, 0-4096, 0 means 4096
-    int memBank,         // memory bank to copy to, 0-15
-    int memAddr,         // address in bank, 0-4095
-    Word *toBufferP,     // the user buffer to copy to memory, should be 4096 words
-    Word *fromBufferP)   // the user buffer to copy memory into, should be 4096 words
+// callerP is where we were called from, it tells which IOT owns the descriptors
+static int
+queueDesc(int chan, HSC_DescP descP, void *callerP)
 {
-Word *memBaseP;
+HSC_ControlP controlP;
+HSC_DescP nextP;
+Dl_info info;
+void *ownerP;
 
-    memBaseP = &pdp1P->core[memBank * 4096];
+    if( (chan < 1) || (chan > 3) || !descP )
+    {
+        return( HSC_ERR );
+    }
 
-    while( count-- > 0 )
+    for( nextP = descP; nextP; nextP = nextP->nextP )
     {
-        if( memAddr > 4095 )
+        if( (nextP->mode & HSC_MODE_IMMEDIATE) || (nextP->status == HSC_BUSY) || (checkDesc(nextP) != HSC_OK) )
         {
-            memAddr = 0;
+            return( HSC_ERR );
         }
+    }
 
-        // Always get from mem first
-        if( mode & HSC_MODE_FROMMEM )
+    ownerP = dladdr(callerP, &info) ? info.dli_fbase : 0;
+    controlP = HSC_chans[chan - 1];
+    if( !controlP->tailPP )
+    {
+        controlP->tailPP = &controlP->headP;
+    }
+
+    for( nextP = descP; nextP; nextP = nextP->nextP )
+    {
+        nextP->status = HSC_BUSY;
+        nextP->ownerP = ownerP;
+    }
+
+    *controlP->tailPP = descP;
+    for( ; descP->nextP; descP = descP->nextP )
+        ;
+    controlP->tailPP = &descP->nextP;
+
+    if( controlP->status != HSC_BUSY )
+    {
+        controlP->status = HSC_BUSY;
+        ++HSC_active;
+        startDesc(controlP);
+        logger("channel %d set to BUSY\n", chan);
+    }
+
+    return( HSC_OK );
+}
+
+int
+HSC_cancel(PDP1 *pdp1P, void *ownerP)
+{
+int i;
+int dropped;
+HSC_ControlP controlP;
+HSC_DescP descP, *descPP;
+
+    dropped = 0;
+    for( i = 0; i < 3; ++i )
+    {
+        controlP = HSC_chans[i];
+        for( descPP = &controlP->headP; (descP = *descPP); )
         {
-            *fromBufferP++ = *(memBaseP + memAddr);
+            if( descP->ownerP != ownerP )
+            {
+                descPP = &descP->nextP;
+                continue;
+            }
+
+            if( descP == controlP->headP )
+            {
+                controlP->count = 0;        // the transfer in progress stops where it is
+            }
+
+            *descPP = descP->nextP;
+            descP->nextP = 0;
+            descP->status = HSC_ERR;
+            ++dropped;
         }
+        controlP->tailPP = descPP;
 
-        if( mode & HSC_MODE_TOMEM )
+        if( controlP->headP )
         {
-            *(memBaseP + memAddr) = *toBufferP++;
+            if( !controlP->count )
+            {
+                startDesc(controlP);
+            }
+        }
+        else if( controlP->status == HSC_BUSY )
+        {
+            idleChannel(pdp1P, controlP);
         }
-
-        ++memAddr;
     }
+
+    return( dropped );
 }
 
 int HSC_get_status(int chan)
@@ -152,47 +248,137 @@ int status;
     return( status );
 }
 
-// process one channel, one word.
-// We do a read before a write if both are enabled.
+static int
+checkDesc(HSC_DescP descP)
+{
+    if( (descP->memBank < 0) || ((descP->memBank + 1) * 4096 > MAXMEM) ||
+        (descP->memAddr < 0) || (descP->memAddr > 4095) || (descP->count < 0) || (descP->count > 4096) )
+    {
+        return( HSC_ERR );
+    }
+
+    if( !(descP->mode & 0x3) )
+    {
+        return( HSC_ERR );      // no from or to, nothing to do
+    } 
+
+    if( (descP->breakChan < 0) || (descP->breakChan > 16) )
+    {
+        return( HSC_ERR );
+    }
+
+    return( HSC_OK );
+}
+
+// the first queued descriptor becomes the current transfer
 static void
-processChannel(PDP1 *pdp1P, HSC_ControlP controlP)
+startDesc(HSC_ControlP controlP)
+{
+HSC_DescP descP;
+
+    descP = controlP->headP;
+    controlP->count = descP->count;
+    controlP->memAddr = descP->memAddr;
+    controlP->toBufP = descP->toBufP;
+    controlP->fromBufP = descP->fromBufP;
+}
+
+// Move count words, at most what's left, wrapping around within the memory bank.
+// We do a read before a write if both are enabled, same as the original hardware.
+// As the buffers are separate, doing that a run of words at a time gives the same result as word by word.
+// Returns the number of words moved.
+static int
+transferWords(PDP1 *pdp1P, HSC_ControlP controlP, int count)
 {
 Word *memBaseP;
-Word word;
+int mode;
+int run;
+int moved;
 
-    if( controlP->status != HSC_BUSY )
+    memBaseP = &pdp1P->core[controlP->headP->memBank * 4096];
+    mode = controlP->headP->mode;
+
+    if( count > controlP->count )
     {
-        return;
+        count = controlP->count;
     }
 
-    // are we done?
-    if( controlP->count-- <= 0 )
+    moved = count;
+    while( count > 0 )
     {
-        logger("processChannel marking DONE\n");
-        controlP->status = HSC_DONE;
-        pdp1P->hsc = 0;
-        return;
+        if( controlP->memAddr > 4095 )
+        {
+            controlP->memAddr = 0;
+        }
+
+        run = 4096 - controlP->memAddr;     // up to the end of the bank
+        if( run > count )
+        {
+            run = count;
+        }
+
+        if( mode & HSC_MODE_FROMMEM )
+        {
+            memcpy(controlP->fromBufP, memBaseP + controlP->memAddr, run * sizeof(Word));
+            controlP->fromBufP += run;
+        }
+
+        if( mode & HSC_MODE_TOMEM )
+        {
+            memcpy(memBaseP + controlP->memAddr, controlP->toBufP, run * sizeof(Word));
+            controlP->toBufP += run;
+        }
+
+        controlP->memAddr += run;
+        controlP->count -= run;
+        count -= run;
     }
 
-    pdp1P->hsc = 1;      // be sure our in-use light is on
+    return( moved );
+}
+
+// The current descriptor is done, tell its owner and start the next.
+static void
+finishDesc(PDP1 *pdp1P, HSC_ControlP controlP)
+{
+HSC_DescP descP;
 
-    memBaseP = &pdp1P->core[controlP->memBank * 4096];
+    descP = controlP->headP;
+    if( !(controlP->headP = descP->nextP) )
+    {
+        controlP->tailPP = &controlP->headP;
+    }
+    descP->nextP = 0;
+    descP->status = HSC_DONE;
 
-    if( controlP->memAddr > 4095 )
+    if( controlP->headP )
+    {
+        startDesc(controlP);
+    }
+    else if( controlP->status == HSC_BUSY )
     {
-        controlP->memAddr = 0;
+        idleChannel(pdp1P, controlP);
     }
 
-    // We do a read from memory before a write to memory, same as the original hardware
-    if( controlP->mode & HSC_MODE_FROMMEM )
+    if( descP->breakChan )
     {
-        *(controlP->fromBufP++) = *(memBaseP + controlP->memAddr);
+        postbreak(pdp1P, descP->breakChan - 1);
     }
 
-    if( controlP->mode & HSC_MODE_TOMEM )
+    if( descP->doneP )
     {
-        *(memBaseP + controlP->memAddr) = *(controlP->toBufP++);
+        descP->doneP(pdp1P, descP);     // may queue more
     }
+}
 
-    controlP->memAddr++;
+// nothing queued anymore
+static void
+idleChannel(PDP1 *pdp1P, HSC_ControlP controlP)
+{
+    logger("processChannel marking DONE\n");
+    controlP->status = HSC_DONE;
+    if( !--HSC_active )
+    {
+        pdp1P->hsc = 0;
+    }
 }
@@ -15,18 +15,38 @@
 #define HSC_MODE_IMMEDIATE     004
 #define HSC_MODE_STEAL         010
 
+// A transfer descriptor. Several can be chained through nextP and queued on a channel in one go,
+// each with its own bank and address, so a device can scatter/gather or queue back-to-back transfers.
+// The descriptors and buffers must stay around until they are done.
+typedef struct _HSC_Desc_ {
+    struct _HSC_Desc_ *nextP;   // next in the chain, 0 for the last, the channel's queue uses it, 0 when done
+    int mode;           // HSC_MODE_FROMMEM, _TOMEM, _STEAL, not _IMMEDIATE
+    int count;          // number of words to transfer, 0-4096
+    int memBank;        // memory bank, 0-15
+    int memAddr;        // address in bank, 0-4095
+    Word *toBufP;       // copied to memory, at least count words
+    Word *fromBufP;     // memory copied into, at least count words
+    void (*doneP)(PDP1 *, struct _HSC_Desc_ *);    // if not 0, called between cycles when this one is done
+    int breakChan;      // if not 0, sequence break requested on channel breakChan-1 when done
+    void *userP;        // for the caller
+    int status;         // HSC_BUSY while queued, HSC_DONE when done, HSC_ERR if cancelled
+    void *ownerP;       // set by HSC_queue, the loaded object that queued it, see HSC_cancel()
+    } HSC_Desc, *HSC_DescP;
+
 typedef struct _HSC_ {
     int status;         // one of the HSC_status codes above
-    int mode;           // current operation mode, from, to, or both
-    int count;          // number of words to transfer
-    int memBank;        // memory bank to transfer to/from, 0-15 dec
-    int memAddr;        // address offset in memory, offset in bank, 0-4095
-    Word *fromBufP;     // should be 4k unless you're sure your count won't exceed the size
-    Word *toBufP;       // ditto
+    HSC_DescP headP;    // queued transfers, the first is in progress
+    HSC_DescP *tailPP;
+    int count;          // words left in the current one
+    int memAddr;        // next address in its bank
+    Word *fromBufP;     // next word in its buffers
+    Word *toBufP;
+    HSC_Desc single;    // used by HSC_request_channel()
     } HSC_Control, *HSC_ControlP;
 
-// called from the emulator run loop
+// called from the emulator run loop when HSC_active, returns the number of 5us cycles stolen
 int processHSChannels(PDP1 *pdp1P);
+extern int HSC_active;      // number of busy channels
 
 // user methods
 int HSC_request_channel(
@@ -40,3 +60,12 @@ int HSC_request_channel(
     Word *fromBuffer);  // the user buffer to copy memory into, must be at least count size
 
 int HSC_get_status(int chan);   // returns one of the HSC statuses
+
+// Queue a chain of descriptors behind whatever the channel is doing. Returns HSC_OK, or HSC_ERR and queues
+// nothing if any of them is out of range or still queued (HSC_BUSY).
+int HSC_queue(PDP1 *pdp1P, int chan, HSC_DescP descP);
+
+// Drop everything queued from the loaded object at ownerP (its dli_fbase) on all channels, without
+// calling doneP or breaking. Called before an IOT is unloaded, its descriptors and code go away.
+// Returns the number of descriptors dropped.
+int HSC_cancel(PDP1 *pdp1P, void *ownerP);
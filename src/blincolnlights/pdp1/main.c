@@ -1,6 +1,8 @@
 #include "common.h"
 #include "pdp1.h"
 #include "args.h"
+#include "tapelib.h"
+#include "ctlproto.h"
 
 #define NOTIOTH
 #include "dynamicIots.h"
@@ -8,9 +10,12 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 #include <pthread.h>
+#include <poll.h>
 
 #include <sys/socket.h>
+#include <sys/eventfd.h>
 
 #include <signal.h>
 
@@ -39,14 +44,12 @@ emu(PDP1 *pdp, Panel *panel)
 	bool prev_examine_sw;
 	bool prev_deposit_sw;
 	bool prev_readin_sw;
+	int stolen;
 	updateswitches(pdp, panel);
 
 	inittime();
 	pdp->simtime = gettime();
-	pdp->dpy[0].last = pdp->simtime;
-	pdp->dpy[1].last = pdp->simtime;
-	pdp->dpy[0].ncmds = 0;
-	pdp->dpy[1].ncmds = 0;
+	initdpys(pdp);
 	for(;;) {
 		prev_start_sw = pdp->start_sw;
 		prev_stop_sw = pdp->stop_sw;
@@ -83,13 +86,17 @@ emu(PDP1 *pdp, Panel *panel)
                     svc_audio(pdp);
                dynamicIotProcessorStart();          // wje - let dyn IOTs know we transitioned to run
 
-               // A dma transfer can be in STEAL mode, in which case it effectively halts the processor
-               // and transfers all of its requested words at 5us/word. We fake this by just not cycling.
-               while( processHSChannels(pdp) )      // wje - handle dma and see if we need to give up cycles
+               // A dma transfer steals a 5us memory cycle for every word it moves, normally one per instruction
+               // cycle. In STEAL mode it effectively halts the processor until all of its words are moved.
+               if( HSC_active )                     // wje - handle dma and give up the cycles it took
                {
-                   updatelights(pdp, panel);
-                   pdp->simtime += 5000;
-                   throttle(pdp);
+                   stolen = processHSChannels(pdp);
+                   pdp->simtime += (u64)stolen * 5000;
+                   if( stolen > 1 )
+                   {
+                       updatelights(pdp, panel);
+                       throttle(pdp);
+                   }
                }
 
                cycle(pdp);
@@ -113,77 +120,287 @@ emu(PDP1 *pdp, Panel *panel)
 			lightsoff(panel);
 
 			pdp->simtime = gettime();
+			pdp->realtime = 0;
 		}
 		agedisplay(pdp, 0);
 		agedisplay(pdp, 1);
+		if(recaudio)
+			svc_wav(pdp);
+		runcmds(pdp);
+		publishview(pdp);
 		cli(pdp);
 	}
 }
 
+// A command connection. Only the net thread touches the socket,
+// the emulator thread queues its replies here, so a client that
+// reads slowly or not at all can't hold up the machine.
+struct NetConn
+{
+	int fd;
+	int wake;	// eventfd, written when a reply is queued
+	pthread_mutex_t lock;
+	u8 *out;	// replies not written yet
+	int nout, outsz;
+	int dead;	// can't write anymore, replies are dropped
+	int closed;	// netclose ran, nothing more will be queued
+};
+
+// stop taking requests while this much is waiting for the client
+#define NETOUTMAX (256*1024)
+// a whole frame fits
+#define NETINSZ (CTL_HDRSZ + CTL_MAXLEN)
+
+// emulator thread
 void
-handlenetcmd(int fd, void *arg)
+netreply(Cmd *c, const void *p, int n)
+{
+	NetConn *nc = c->conn;
+	u64 x = 1;
+
+	pthread_mutex_lock(&nc->lock);
+	if(!nc->dead) {
+		if(nc->nout + n > nc->outsz) {
+			nc->outsz = 2*(nc->nout + n);
+			nc->out = realloc(nc->out, nc->outsz);
+		}
+		memcpy(nc->out + nc->nout, p, n);
+		nc->nout += n;
+	}
+	pthread_mutex_unlock(&nc->lock);
+	write(nc->wake, &x, sizeof(x));
+}
+
+// these run on the emulator thread, see postcmd()
+static void
+netcmd(PDP1 *pdp, Cmd *c)
+{
+	char *r = handlecmd(pdp, c->line);
+	int n = strlen(r);
+	r[n] = '\n';
+	r[n+1] = '\0';
+	netreply(c, r, n+1);
+}
+
+// the last command of a connection
+static void
+netclose(PDP1 *pdp, Cmd *c)
+{
+	NetConn *nc = c->conn;
+	u64 x = 1;
+
+	// the net thread frees nc once it sees closed,
+	// so wake it before letting go of the lock
+	pthread_mutex_lock(&nc->lock);
+	nc->closed = 1;
+	write(nc->wake, &x, sizeof(x));
+	pthread_mutex_unlock(&nc->lock);
+}
+
+static void
+newcmd(PDP1 *pdp, int fd, NetConn *nc, void (*fn)(PDP1*, Cmd*), const char *line)
+{
+	Cmd *c = malloc(sizeof(Cmd));
+	c->fn = fn;
+	c->fd = fd;
+	c->conn = nc;
+	snprintf(c->line, sizeof(c->line), "%s", line);
+	c->data = nil;
+	c->len = 0;
+	postcmd(pdp, c);
+}
+
+// Post what is complete in p: lines, or binary frames (see
+// ctlproto.h) once a line starts with CTL_MAGIC, for the rest of
+// the connection. Returns the bytes used, -1 on a bad frame.
+static int
+parsenet(PDP1 *pdp, NetConn *nc, u8 *p, int n, int *ctl)
+{
+	u8 *s, *e, *nl;
+	Cmd *c;
+	u32 len;
+
+	s = p;
+	e = p + n;
+	while(s < e) {
+		if(!*ctl && *s == CTL_MAGIC)
+			*ctl = 1;
+		if(!*ctl) {
+			if((nl = memchr(s, '\n', e-s)) == nil)
+				break;
+			*nl = '\0';
+			newcmd(pdp, nc->fd, nc, netcmd, (char*)s);
+			s = nl+1;
+			continue;
+		}
+		if(e-s < CTL_HDRSZ)
+			break;
+		len = s[4] | s[5]<<8 | s[6]<<16 | (u32)s[7]<<24;
+		if(s[0] != CTL_MAGIC || len > CTL_MAXLEN)
+			return -1;
+		if(e-s < CTL_HDRSZ + len)
+			break;
+		c = malloc(sizeof(Cmd) + len);
+		c->fn = ctlcmd;
+		c->fd = nc->fd;
+		c->conn = nc;
+		c->op = s[1];
+		c->tag = s[2] | s[3]<<8;
+		c->data = (u8*)(c+1);
+		c->len = len;
+		memcpy(c->data, s+CTL_HDRSZ, len);
+		postcmd(pdp, c);
+		s += CTL_HDRSZ + len;
+	}
+	return s - p;
+}
+
+// as much of the queued replies as the socket takes
+static void
+flushnet(NetConn *nc)
 {
-	PDP1 *pdp = (PDP1*)arg;
-	char line[1024];
 	int n;
-	while(n = read(fd, line, sizeof(line)), n > 0) {
-//		printf("got %d bytes\n", n);
-		line[n] = 0;
-//		printf("<%s>\n", line);
-		char *r = handlecmd(pdp, line);
-//printf("reply: <%s>\n", r);
-		n = strlen(r);
-		r[n] = '\n';
-		r[n+1] = '\0';
-		write(fd, r, strlen(r));
+
+	pthread_mutex_lock(&nc->lock);
+	n = write(nc->fd, nc->out, nc->nout);
+	if(n > 0) {
+		memmove(nc->out, nc->out+n, nc->nout-n);
+		nc->nout -= n;
+	} else if(n < 0 && errno != EAGAIN && errno != EINTR) {
+		nc->dead = 1;
+		nc->nout = 0;
 	}
-//	printf("closing\n");
-	close(fd);
+	pthread_mutex_unlock(&nc->lock);
 }
 
+// One command per line. The replies come back in order from the
+// emulator, so commands can be sent without waiting for them.
+// The connection is kept until the emulator has run everything
+// the client sent and the replies are out.
 void
-connectdpy(PDP1 *pdp, DispCon *d, int fd)
+handlenetcmd(int fd, void *arg)
 {
-	if(d->fd >= 0) {
-		close(fd);
-	} else {
-		d->fd = fd;
-		d->last = pdp->simtime;
-		d->agetime = 50*1000;
-		nodelay(d->fd);
+	PDP1 *pdp = (PDP1*)arg;
+	NetConn *nc;
+	struct pollfd pfd[2];
+	u8 *in;
+	int nin, n, ctl, eof, pending, closed, dead;
+	u64 x;
+
+	nc = calloc(1, sizeof(NetConn));
+	nc->fd = fd;
+	nc->wake = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	pthread_mutex_init(&nc->lock, nil);
+	nodelay(fd);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	in = malloc(NETINSZ);
+	nin = 0;
+	ctl = 0;
+	eof = 0;
+	for(;;) {
+		pthread_mutex_lock(&nc->lock);
+		pending = nc->nout;
+		closed = nc->closed;
+		dead = nc->dead;
+		pthread_mutex_unlock(&nc->lock);
+		if(closed && pending == 0)
+			break;
+		if(dead && !eof)
+			goto hangup;
+
+		pfd[0].fd = fd;
+		pfd[0].events = 0;
+		if(!eof && pending < NETOUTMAX)
+			pfd[0].events |= POLLIN;
+		if(pending)
+			pfd[0].events |= POLLOUT;
+		if(pfd[0].events == 0)
+			pfd[0].fd = -1;
+		pfd[1].fd = nc->wake;
+		pfd[1].events = POLLIN;
+		if(poll(pfd, 2, -1) < 0)
+			continue;
+		if(pfd[1].revents)
+			read(nc->wake, &x, sizeof(x));
+		if(pfd[0].revents & (POLLOUT|POLLERR))
+			flushnet(nc);
+		if(eof || !(pfd[0].revents & (POLLIN|POLLHUP|POLLERR)))
+			continue;
+
+		n = read(fd, in+nin, NETINSZ-nin);
+		if(n < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
+		if(n <= 0)
+			goto hangup;
+		nin += n;
+		if((n = parsenet(pdp, nc, in, nin, &ctl)) < 0)
+			goto hangup;
+		nin -= n;
+		memmove(in, in+n, nin);
+		if(nin == NETINSZ && !ctl) {
+			// no newline in sight, take it as one
+			in[nin-1] = '\0';
+			newcmd(pdp, fd, nc, netcmd, (char*)in);
+			nin = 0;
+		}
+		continue;
+
+	hangup:
+		// a last line without a newline still counts
+		if(!ctl && nin > 0 && !dead) {
+			in[nin < NETINSZ ? nin : NETINSZ-1] = '\0';
+			newcmd(pdp, fd, nc, netcmd, (char*)in);
+		}
+		nin = 0;
+		eof = 1;
+		newcmd(pdp, fd, nc, netclose, "");
 	}
+	close(fd);
+	close(nc->wake);
+	pthread_mutex_destroy(&nc->lock);
+	free(nc->out);
+	free(nc);
+	free(in);
 }
 
 void
 handledpy(int fd, void *arg)
 {
 	PDP1 *pdp = (PDP1*)arg;
-	connectdpy(pdp, &pdp->dpy[0], fd);
+	if(connectdpy(pdp, 0, fd) < 0)
+		close(fd);
 }
 
 void
 handledpy2(int fd, void *arg)
 {
 	PDP1 *pdp = (PDP1*)arg;
-	connectdpy(pdp, &pdp->dpy[1], fd);
+	if(connectdpy(pdp, 1, fd) < 0)
+		close(fd);
+}
+
+static void
+mountptr(PDP1 *pdp, Cmd *c)
+{
+	close(pdp->r_fd);
+	setreader(pdp, c->fd, PTR_NET);
 }
 
 void
 handleptr(int fd, void *arg)
 {
 	PDP1 *pdp = (PDP1*)arg;
-	close(pdp->r_fd);
-	pdp->r_fd = fd;
-	nodelay(pdp->r_fd);
+	nodelay(fd);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	newcmd(pdp, fd, nil, mountptr, "");
 }
 
 void
 handleptp(int fd, void *arg)
 {
 	PDP1 *pdp = (PDP1*)arg;
-	close(pdp->p_fd);
-	pdp->p_fd = fd;
-	nodelay(pdp->p_fd);
+	nodelay(fd);
+	setpunch(pdp, fd);
 }
 
 void*
@@ -205,7 +422,7 @@ char *argv0;
 void
 usage(void)
 {
-	fprintf(stderr, "usage: %s [-h host] [-p port]\n", argv0);
+	fprintf(stderr, "usage: %s [-h host] [-p port] [-i iotdir]\n", argv0);
 	exit(1);
 }
 
@@ -271,6 +488,7 @@ void
 exitcleanup(void)
 {
 	dumpmem("coremem", memp, memsz);
+	flushpunch(visiblePDP1P);
 	lightsoff(panel);
 }
 
@@ -287,11 +505,13 @@ main(int argc, char *argv[])
 	PDP1 pdp1, *pdp = &pdp1;
 	visiblePDP1P = pdp;
 	pthread_t th;
-	const char *host;
+	TapeImage *t;
+	const char *host, *iotdir;
 	int port;
 
 	host = "localhost";
 	port = 3400;
+	iotdir = nil;
 	ARGBEGIN {
 	case 'h':
 		host = EARGF(usage());
@@ -299,6 +519,9 @@ main(int argc, char *argv[])
 	case 'p':
 		port = atoi(EARGF(usage()));
 		break;
+	case 'i':
+		iotdir = EARGF(usage());
+		break;
 	default:
 		usage();
 	} ARGEND;
@@ -321,16 +544,14 @@ main(int argc, char *argv[])
 	readmem("coremem", memp, memsz);
 
 	startpolling();     // wje
+	initview(pdp);
+	dynamicIotLoadAll(iotdir);      // wje - before anything runs, handlers may watch fds
 
-	pdp->dpy[0].fd = -1;
-	pdp->dpy[1].fd = -1;
 //	pdp->dpy[0].fd = dial(host, port);
 //	if(pdp->dpy[0].fd < 0)
 //		printf("can't open display\n");
 //	nodelay(pdp->dpy[0].fd);
 
-	pthread_create(&th, NULL, netthread, pdp);
-
 //	const char *tape = "maindec/maindec1_20.rim";
 //	const char *tape = "tapes/circle.rim";
 //	const char *tape = "tapes/munch.rim";
@@ -340,9 +561,15 @@ main(int argc, char *argv[])
 	const char *tape = "tapes/dpys5.rim";
 	pdp->muldiv_sw = 1;
 
-	pdp->r_fd = open(tape, O_RDONLY);
+	setreader(pdp, -1, PTR_FILE);
+	if((t = tapeopen(tape)) != nil)
+		mounttape(pdp, t);
 
 	pdp->p_fd = open("punch.out", O_CREAT|O_WRONLY|O_TRUNC, 0644);
+	pdp->p_next = P_KEEP;
+
+	// the net thread can mount and punch right away
+	pthread_create(&th, NULL, netthread, pdp);
 
 	pdp->typ_fd.id = -1;
 	int fd[2];
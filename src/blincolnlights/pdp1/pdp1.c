@@ -2,6 +2,12 @@
 #include "pdp1.h"
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <dirent.h>
+#include "ptrproto.h"
+#include "pdp1view.h"	// and ctlproto.h
+#include "tapelib.h"
 
 #define NOTIOTH
 #include "dynamicIots.h"
@@ -30,13 +36,24 @@
 
 #define US(us) ((us)*1000 - 1)
 #define RDLY US(2500)		// 400/s
+#define RFAST US(10)		// while loading fast
+#define LOADIDLE US(20000)	// reader idle this long, loading is done
+#define PSYNC US(20000)		// write punched characters at least this often
+#define POLLQ US(1000)		// look at input fds this often
+#define VIEWQ US(1000)		// publish registers this often
+#define VIEWCORE 33333333	// ns real time, publish core this often
 #define PDLY US(15873)		// 63/s
 #define TYODLY US(100000)	// has to be long enough for MACRO to work
+#define TYIDLY US(25000)	// between typed in characters
+#define TYIPASTE US(1000)	// same with paste on and more waiting
 
 #define RD_CHAN 1
 #define PUN_CHAN 6
 #define TTI_CHAN 7
 #define TTO_CHAN 8
+#define LP_CHAN 0	// no standard assignment that we know of
+
+#define LPRAD 6		// light pen aperture in display units
 
 static void iot_pulse(PDP1 *pdp, int pulse, int dev, int nac);
 static void iot(PDP1 *pdp, int pulse);
@@ -163,6 +180,7 @@ pwrclr(PDP1 *pdp)
 
 	pdp->dpy_defl_time = NEVER;
 	pdp->dpy_time = NEVER;
+	pdp->lp = 0;
 }
 
 static void
@@ -274,14 +292,26 @@ clr_sbs(PDP1 *pdp)
 static void
 hold_break(PDP1 *pdp)
 {
+	if(pdp->req)
+		pdp->sbbreaks[__builtin_ctz(pdp->req)]++;
 	pdp->b4 |= pdp->req;
 	if(!pdp->sbs16)
 		pdp->b2 = 0;
 	sbs_calc_req(pdp);
 }
+static void req(PDP1 *pdp, int chan);
 static void
 sbs_sync(PDP1 *pdp)
 {
+	u32 pend;
+	int ch;
+
+	if(pdp->sbpend) {
+		pend = __atomic_exchange_n(&pdp->sbpend, 0, __ATOMIC_ACQUIRE);
+		for(ch = 0; pend; ch++, pend >>= 1)
+			if(pend & 1)
+				req(pdp, ch);
+	}
 	pdp->b3 |= pdp->b2;
 	sbs_calc_req(pdp);
 }
@@ -1161,16 +1191,28 @@ cycle(PDP1 *pdp)
 	else if(!pdp->cyc) cycle0(pdp);
 	else if(pdp->df1) defer(pdp);
 	else cycle1(pdp);
-    // update any IOTs regardless of cycle type
-    dynamicIotProcessorDoPoll(pdp);             // wje - handle pseudo-async IOTs
+    // update any IOTs regardless of cycle type, but only when one is due
+    if( pdp->simtime >= dynamicIotNextPoll )
+        dynamicIotProcessorDoPoll(pdp);         // wje - handle pseudo-async IOTs
 }
 
 void
 throttle(PDP1 *pdp)
 {
+	// run free, realtime 0 makes us catch up with simtime afterwards
+	if(pdp->fast) {
+		pdp->realtime = 0;
+		return;
+	}
+	if(pdp->realtime == 0) {
+		pdp->timeoff = pdp->simtime - gettime();
+		pdp->realtime = pdp->simtime;
+	}
 	while(pdp->realtime < pdp->simtime) {
-		usleep(1000);
-		pdp->realtime = gettime();
+		// sleep where input can find us
+		pollfds(1);
+		pdp->poll_time = pdp->simtime + POLLQ;
+		pdp->realtime = gettime() + pdp->timeoff;
 	}
 }
 
@@ -1198,7 +1240,7 @@ iot_pulse(PDP1 *pdp, int pulse, int dev, int nac)
 				pdp->rc = 1;
 				pdp->rcl = 1;
 			}
-			pdp->r_time = pdp->simtime + RDLY;
+			pdp->r_time = pdp->simtime + (pdp->fast&FAST_LOAD ? RFAST : RDLY);
 			pdp->rb = 0;
 		}
 		break;
@@ -1246,6 +1288,7 @@ iot_pulse(PDP1 *pdp, int pulse, int dev, int nac)
 			pdp->dbx = 0;
 			pdp->dby = 0;
 			pdp->dint = 0;
+			pdp->lp = 0;
 		} else {
 			pdp->dcp = nac;
 			pdp->dbx |= AC>>8;
@@ -1273,7 +1316,7 @@ iot_pulse(PDP1 *pdp, int pulse, int dev, int nac)
 
 	case 033:	// cks
 		if(pulse) {
-			// TODO: LP
+			IO |= pdp->lp<<17;
 			IO |= pdp->rbs<<16;
 			IO |= !pdp->tyo<<15;
 			IO |= pdp->tbs<<14;
@@ -1350,114 +1393,240 @@ iot(PDP1 *pdp, int pulse)
 static void
 req(PDP1 *pdp, int chan)
 {
+	pdp->sbreqs[pdp->sbs16 ? chan : 0]++;
 	if(pdp->sbs16)
 		pdp->b2 |= pdp->b1 & (1<<chan);
 	else
 		pdp->b2 = 1;
 }
 
-// Let the dynamic IOT code trigger a break
+// Request a break from any thread, it's taken up at the next sbs_sync()
+// like one from a built-in device.
 void
-dynamicReq(PDP1 *pdp, int chan)
+postbreak(PDP1 *pdp, int chan)
 {
-    req(pdp, chan);             // wje - because req() is private
-}
-
-void
-flushdpy(DispCon *d)
-{
-	int sz = d->ncmds*sizeof(d->cmdbuf[0]);
-	int n = write(d->fd, d->cmdbuf, sz);
-	d->ncmds = 0;
-	if(n < sz) {
-		close(d->fd);
-		d->fd = -1;
-	}
+	__atomic_or_fetch(&pdp->sbpend, 1<<(chan&017), __ATOMIC_RELEASE);
 }
 
+// Let the dynamic IOT code trigger a break
 void
-dpycmd(PDP1 *pdp, int i, u32 cmd)
+dynamicReq(PDP1 *pdp, int chan)
 {
-	DispCon *d = &pdp->dpy[i];
-	d->cmdbuf[d->ncmds++] = cmd;
-	if(d->ncmds == nelem(d->cmdbuf))
-		flushdpy(d);
+    postbreak(pdp, chan);       // wje - IOT threads and workers too
 }
 
-void
-agedisplay(PDP1 *pdp, int i)
+// The pen only sees the flash of the point being intensified,
+// so testing that one point against the aperture is all we need.
+static void
+lightpen(PDP1 *pdp, int i, int x, int y)
 {
-	DispCon *d = &pdp->dpy[i];
-	if(d->fd < 0)
+	u32 pen = pdp->dpy[i].pen;
+	if((pen>>20 & 1) == 0)
 		return;
-	int ival = d->agetime;
-	assert(d->last <= pdp->simtime);
-	u64 dt = (pdp->simtime - d->last)/1000;
-	if(dt >= ival) {
-		dpycmd(pdp, i, 511<<23);
-		// TODO? theoretically dt could be huge,
-		// but if it is you have other problems
-		dpycmd(pdp, i, dt);
-		d->last = pdp->simtime;
-		flushdpy(d);
-
-		// increase interval during fade out
-		// to reduce number of age-commands
-		if(d->agetime < 1000*1000)
-			d->agetime += d->agetime/6;
+	int dx = x - (pen>>10 & 01777);
+	int dy = y - (pen & 01777);
+	if(dx*dx + dy*dy <= LPRAD*LPRAD) {
+		pdp->lp = 1;
+		req(pdp, LP_CHAN);
 	}
 }
 
+static void
+plot(PDP1 *pdp, int i, u32 pt)
+{
+	lightpen(pdp, i, pt & 01777, pt>>10 & 01777);
+	dpyplot(pdp, i, pt);
+}
+
 void
-display(PDP1 *pdp, int i)
-{
-	// need to make sure dt field doesn't overflow cmd
-	pdp->dpy[i].agetime = 510;
-	agedisplay(pdp, i);
-	// reset age interval for every point shown
-	pdp->dpy[i].agetime = 50*1000;
-	if(pdp->dpy[i].fd < 0)
+display(PDP1 *pdp)
+{
+	if(pdp->dpyroute == ROUTE_NONE)
 		return;
 	int x = pdp->dbx;
 	int y = pdp->dby;
-	int dt = (pdp->simtime - pdp->dpy[i].last)/1000;
 	if(x & 01000) x++;
 	if(y & 01000) y++;
 	x = (x+01000)&01777;
 	y = (y+01000)&01777;
-	int cmd = x | (y<<10) | (dt<<23);
+	u32 pt = x | (y<<10);
 	int in = pdp->dint;
-	// checking fd's is a bit of a hack of course.
-	// this is really a hardware configuration
-	int twoscreens = pdp->dpy[0].fd >= 0 && pdp->dpy[1].fd >= 0;
-	if(twoscreens) {
-		if(!!(pdp->dint&4) != i)
-			return;
+	switch(pdp->dpyroute) {
+	case ROUTE_0:
+		plot(pdp, 0, pt | ((in+4)&7)<<20);
+		break;
+	case ROUTE_1:
+		plot(pdp, 1, pt | ((in+4)&7)<<20);
+		break;
+	case ROUTE_MIRROR:
+		pt |= ((in+4)&7)<<20;
+		plot(pdp, 0, pt);
+		plot(pdp, 1, pt);
+		break;
+	case ROUTE_SPLIT:
 		// unclear what's happening here exactly
 		// spacewar 4.4 uses only intensity 0/4
-		in &= 3;
+		plot(pdp, !!(in&4), pt | ((in&3)+4)<<20);
+		break;
+	}
+}
+
+void
+setreader(PDP1 *pdp, int fd, int proto)
+{
+	pdp->r_pos = pdp->r_n = 0;
+	tapeclose(pdp->r_tape);
+	pdp->r_tape = nil;
+	pdp->r_credit = 0;
+	pdp->r_proto = proto;
+	pdp->r_fast = pdp->fastload;
+	__atomic_and_fetch(&pdp->fast, ~FAST_LOAD, __ATOMIC_RELAXED);
+	pdp->r_fd = fd;
+}
+
+// tape from the library, read straight from the mapping
+void
+mounttape(PDP1 *pdp, TapeImage *t)
+{
+	setreader(pdp, -1, PTR_FILE);
+	pdp->r_tape = t;
+	pdp->r_tpos = 0;
+}
+
+// returns what we have buffered, 0 if nothing now, -1 at end of tape
+static int
+fillreader(PDP1 *pdp)
+{
+	int n;
+
+	if(pdp->r_pos < pdp->r_n)
+		return pdp->r_n - pdp->r_pos;
+	pdp->r_pos = pdp->r_n = 0;
+	n = read(pdp->r_fd, pdp->r_buf, sizeof(pdp->r_buf));
+	if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+	if(n <= 0)
+		return -1;
+	pdp->r_n = n;
+	return n;
+}
+
+// next tape character, -1 if none yet, -2 at end of tape
+static int
+readerchar(PDP1 *pdp)
+{
+	int n;
+
+	if(pdp->r_tape)
+		return pdp->r_tpos < pdp->r_tape->n ?
+			pdp->r_tape->p[pdp->r_tpos++] : -2;
+	if((n = fillreader(pdp)) <= 0)
+		return n-1;
+	if(pdp->r_proto == PTR_NET) {
+		if(pdp->r_buf[pdp->r_pos] != PTR_HELLO)
+			pdp->r_proto = 1;
+		else if(n < 2) {
+			// rest of the hello is still on its way
+			pdp->r_buf[0] = PTR_HELLO;
+			pdp->r_pos = 0;
+			n = read(pdp->r_fd, pdp->r_buf+1, sizeof(pdp->r_buf)-1);
+			pdp->r_n = 1 + (n > 0 ? n : 0);
+			if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+				return -2;
+			return -1;
+		} else {
+			pdp->r_proto = pdp->r_buf[pdp->r_pos+1];
+			pdp->r_pos += 2;
+			return readerchar(pdp);
+		}
+	}
+	return pdp->r_buf[pdp->r_pos++];
+}
+
+// confirm what the reader took so the peripheral can send more
+static void
+readercredit(PDP1 *pdp)
+{
+	u8 buf[16];
+	int n;
+
+	n = 0;
+	while(pdp->r_credit > 0 && n < (int)sizeof(buf)) {
+		buf[n] = pdp->r_credit > 255 ? 255 : pdp->r_credit;
+		pdp->r_credit -= buf[n++];
 	}
-	cmd |= ((in+4)&7)<<20;
+	write(pdp->r_fd, buf, n);
+}
+
+// Called from any thread, the emulator switches at the next handleio()
+// so nothing that is still buffered for the old fd gets lost.
+void
+setpunch(PDP1 *pdp, int fd)
+{
+	fd = __atomic_exchange_n(&pdp->p_next, fd, __ATOMIC_ACQ_REL);
+	if(fd >= 0)
+		close(fd);	// never got used
+}
+
+void
+flushpunch(PDP1 *pdp)
+{
+	if(pdp->p_n && pdp->p_fd >= 0)
+		write(pdp->p_fd, pdp->p_buf, pdp->p_n);
+	pdp->p_n = 0;
+	pdp->p_ftime = pdp->simtime;
+}
 
-	pdp->dpy[i].last = pdp->simtime;
-	dpycmd(pdp, i, cmd);
+static void
+punchchar(PDP1 *pdp, int c)
+{
+	if(pdp->p_fd < 0)
+		return;
+	pdp->p_buf[pdp->p_n++] = c;
+	if(pdp->p_n == sizeof(pdp->p_buf))
+		flushpunch(pdp);
 }
 
 void
 handleio(PDP1 *pdp)
 {
+	if(pdp->poll_time < pdp->simtime) {
+		pollfds(0);
+		pdp->poll_time = pdp->simtime + POLLQ;
+	}
+
 	/* Reader */
-	if(pdp->rcl && pdp->r_time < pdp->simtime && pdp->r_fd >= 0) {
-		u8 c;
-		pdp->r_time = pdp->simtime + RDLY;
-		if(read(pdp->r_fd, &c, 1) <= 0) {
+	if(pdp->r_credit &&
+	   (pdp->r_credit >= PTR_BATCH ||
+	    pdp->simtime - pdp->r_ctime >= PTR_SYNC*1000000ull))
+		readercredit(pdp);
+	// the loader jumped to the program after the tape stopped, back to normal
+	if(pdp->fast&FAST_LOAD && IR_JMP &&
+	   pdp->simtime - pdp->r_ctime >= LOADIDLE) {
+		__atomic_and_fetch(&pdp->fast, ~FAST_LOAD, __ATOMIC_RELAXED);
+		pdp->r_fast = 0;
+	}
+	if(pdp->rcl && pdp->r_time < pdp->simtime &&
+	   (pdp->r_fd >= 0 || pdp->r_tape)) {
+		int c;
+		pdp->r_time = pdp->simtime + (pdp->fast&FAST_LOAD ? RFAST : RDLY);
+		c = readerchar(pdp);
+		if(c == -1)
+			return;
+		if(c < 0) {
 			close(pdp->r_fd);
-			pdp->r_fd = -1;
+			setreader(pdp, -1, PTR_FILE);
 			return;
 		}
-		// write back in case this is over a socket
-		// and we need to synchronize
-		write(pdp->r_fd, &c, 1);
+		if(pdp->r_proto == 1) {
+			// old peripheral waits for this before it sends more
+			u8 b = c;
+			write(pdp->r_fd, &b, 1);
+		} else if(pdp->r_proto != PTR_FILE)
+			pdp->r_credit++;
+		pdp->r_ctime = pdp->simtime;
+		if(pdp->r_fast && !(pdp->fast&FAST_LOAD))
+			__atomic_or_fetch(&pdp->fast, FAST_LOAD, __ATOMIC_RELAXED);
 		if(pdp->rc && (!pdp->rby || c&0200)) {
 			// STROBE PETR
 			pdp->rcl = 0;
@@ -1489,21 +1658,22 @@ handleio(PDP1 *pdp)
 	}
 
 	/* Punch */
+	if(pdp->p_next != P_KEEP) {
+		flushpunch(pdp);
+		close(pdp->p_fd);
+		pdp->p_fd = __atomic_exchange_n(&pdp->p_next, P_KEEP, __ATOMIC_ACQ_REL);
+	}
 	if(pdp->punon && pdp->p_time < pdp->simtime) {
 		pdp->p_time = NEVER;
-		if(pdp->p_fd >= 0) {
-			char c = pdp->pb;
-			write(pdp->p_fd, &c, 1);
-		}
+		punchchar(pdp, pdp->pb);
 		if(pdp->pcp) pdp->ios = 1;
 		req(pdp, PUN_CHAN);
 	} else if(pdp->tape_feed && pdp->feed_time < pdp->simtime) {
 		pdp->feed_time = pdp->simtime + PDLY;
-		if(pdp->p_fd >= 0) {
-			char c = 0;
-			write(pdp->p_fd, &c, 1);
-		}
+		punchchar(pdp, 0);
 	}
+	if(pdp->p_n && pdp->simtime - pdp->p_ftime >= PSYNC)
+		flushpunch(pdp);
 
 	/* Typewriter */
 	if(pdp->typ_time < pdp->simtime) {
@@ -1528,15 +1698,14 @@ handleio(PDP1 *pdp)
 	}
 	// stall input while we're outputting stuff
 	if(pdp->typ_time != NEVER)
-		pdp->tyi_wait = pdp->simtime + US(25000);
-	if(pdp->tyi_wait < pdp->simtime && pdp->typ_fd.ready) {
-		char c;
-		if(read(pdp->typ_fd.fd, &c, 1) <= 0) {
+		pdp->tyi_wait = pdp->simtime + TYIDLY;
+	// characters wait in typ_fd until the program took the last one
+	if(pdp->tyi_wait < pdp->simtime && !pdp->tbs && fdready(&pdp->typ_fd)) {
+		int c = fdgetc(&pdp->typ_fd);
+		if(c < 0) {
 			closefd(&pdp->typ_fd);
-			pdp->typ_fd.fd = -1;
 			return;
 		}
-		waitfd(&pdp->typ_fd);
 if(pdp->pf & 040) printf("	char missed <%o>\n", pdp->tb);
 		pdp->tb = 0;
 		// STROBE TYPE
@@ -1547,16 +1716,15 @@ if(pdp->pf & 040) printf("	char missed <%o>\n", pdp->tb);
 		pdp->pf |= 040;
 		req(pdp, TTI_CHAN);
 
-		// PDP-1 has to keep up, so avoid clobbering TB
-		// not sure what a good timeout here is
-		pdp->tyi_wait = pdp->simtime + US(25000);
+		// give the program time to do something with it
+		pdp->tyi_wait = pdp->simtime +
+			(pdp->typ_paste && fdready(&pdp->typ_fd) ? TYIPASTE : TYIDLY);
 	}
 
 	/* Display */
 	if(pdp->dpy_defl_time < pdp->simtime) {
 		pdp->dpy_defl_time = NEVER;
-		display(pdp, 0);
-		display(pdp, 1);
+		display(pdp);
 	}
 	if(pdp->dpy_time < pdp->simtime) {
 		pdp->dpy_time = NEVER;
@@ -1564,50 +1732,112 @@ if(pdp->pf & 040) printf("	char missed <%o>\n", pdp->tb);
 	}
 }
 
-int
-getwrd(int fd)
+static int
+loaderr(char *resp, const char *fmt, ...)
 {
-	u8 c;
-	int w, n;
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsprintf(resp, fmt, ap);
+	va_end(ap);
+	return -1;
+}
 
-	w = 0;
-	n = 3;
-	while(n--) {
-		do {
-			if(read(fd, &c, 1) <= 0)
-				return -1;
-		} while((c&0200) == 0);
-		w = w<<6 | (c&077);
+// Load a tape straight into core, what read-in and the loader
+// on the tape would do without the reader. The library has
+// already found the blocks, we only copy them. Only what's on
+// the tape is touched, PC is set to the start address.
+// BIN blocks are only stored up to the first bad checksum.
+static int
+loadtape(PDP1 *pdp, TapeImage *t, char *resp)
+{
+	TapeBlock *b;
+	int i, pos;
+
+	if(t->format == TAPE_RAW)
+		return loaderr(resp, "no RIM block on tape");
+	for(b = t->blk; b < t->blk+t->nblk; b++) {
+		pos = b->off;
+		switch(b->type) {
+		case BLK_RIM:
+			for(i = 0; i < b->n; i++) {
+				int a = tapeword(t, &pos);
+				pdp->core[a&07777] = tapeword(t, &pos);
+			}
+			break;
+		case BLK_BIN:
+			if(!b->sumok)
+				return loaderr(resp, "checksum error in BIN block %04o-%04o",
+					b->addr, b->addr+b->n-1);
+			tapeword(t, &pos);	// dio start
+			tapeword(t, &pos);	// dio end
+			for(i = 0; i < b->n; i++)
+				pdp->core[b->addr+i] = tapeword(t, &pos);
+			break;
+		case BLK_AM1:
+			tapeword(t, &pos);
+			tapeword(t, &pos);
+			for(i = 0; i < b->n; i++)
+				pdp->core[b->addr+i] = tapeword(t, &pos);
+			break;
+		}
 	}
-	return w;
+	if(t->err[0])
+		return loaderr(resp, "%s", t->err);
+	if(t->start < 0)
+		return loaderr(resp, "tape loaded, no start address");
+	if(t->format == TAPE_AM1)
+		pdp->exd = 1;	// the loader ran with eem
+	PC = t->start&07777;
+	pdp->epc = t->start&EXTMASK;
+	sprintf(resp, "start %o", t->start);
+	return 0;
 }
 
-void
-readrim(PDP1 *pdp, int fd)
+// one line per tape: name, format, start, blocks, what's wrong.
+// opening indexes the tape and keeps it cached for mounting.
+static void
+listtapes(char *resp, int max, const char *dir)
 {
-	int inst, wd;
+	DIR *d;
+	struct dirent *e;
+	TapeImage *t;
+	char path[1024];
+	char *p;
+	int n;
 
-	if(fd < 0) {
-		fprintf(stderr, "no tape\n");
+	if((d = opendir(dir)) == nil) {
+		sprintf(resp, "couldn't open %s", dir);
 		return;
 	}
-
-	// clear memory just to be safe
-	for(wd = 0; wd < MAXMEM; wd++)
-		pdp->core[wd] = 0;
-	for(;;) {
-		inst = getwrd(fd);
-		if((inst&0760000) == 0320000) {
-			wd = getwrd(fd);
-			pdp->core[inst&07777] = wd;
-		} else if((inst&0760000) == 0600000) {
-			printf("start: %04o\n", inst&07777);
-			return;
-		} else {
-			printf("rim botch: %06o\n", inst);
-			return;
+	p = resp;
+	*p = '\0';
+	while((e = readdir(d)) != nil) {
+		if(e->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		if((t = tapeopen(path)) == nil)
+			continue;
+		n = snprintf(p, max, "%s%-24s %s", p == resp ? "" : "\n",
+			e->d_name, tapeformat(t));
+		// once it's truncated max-n would go negative
+		if(n < max && t->start >= 0)
+			n += snprintf(p+n, max-n, " start %o", t->start);
+		if(n < max && t->nblk)
+			n += snprintf(p+n, max-n, " %d blocks", t->nblk);
+		if(n < max && t->badsum)
+			n += snprintf(p+n, max-n, ", %d bad", t->badsum);
+		if(n < max && t->err[0])
+			n += snprintf(p+n, max-n, ", %s", t->err);
+		tapeclose(t);
+		if(n >= max) {
+			*p = '\0';	// doesn't fit
+			break;
 		}
+		p += n;
+		max -= n;
 	}
+	closedir(d);
 }
 
 void
@@ -1631,11 +1861,300 @@ cli(PDP1 *pdp)
 	}
 }
 
+// any thread, c is freed after it ran
+void
+postcmd(PDP1 *pdp, Cmd *c)
+{
+	c->next = __atomic_load_n(&pdp->cmdq, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&pdp->cmdq, &c->next, c, 1,
+	                                   __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	pollwake();
+}
+
+// emulator thread, where nothing is half done
+void
+runcmds(PDP1 *pdp)
+{
+	Cmd *c, *next, *list;
+
+	if(__atomic_load_n(&pdp->cmdq, __ATOMIC_RELAXED) == nil)
+		return;
+	c = __atomic_exchange_n(&pdp->cmdq, nil, __ATOMIC_ACQUIRE);
+	// oldest first
+	list = nil;
+	for(; c; c = next) {
+		next = c->next;
+		c->next = list;
+		list = c;
+	}
+	for(c = list; c; c = next) {
+		next = c->next;
+		c->fn(pdp, c);
+		free(c);
+	}
+}
+
+static u32
+get32(const u8 *p)
+{
+	return p[0] | p[1]<<8 | p[2]<<16 | (u32)p[3]<<24;
+}
+
+static u8*
+put32(u8 *p, u32 w)
+{
+	p[0] = w;
+	p[1] = w>>8;
+	p[2] = w>>16;
+	p[3] = w>>24;
+	return p+4;
+}
+
+static void
+getregs(PDP1 *pdp, u32 *r)
+{
+	r[CTL_AC] = AC;
+	r[CTL_IO] = IO;
+	r[CTL_PC] = pdp->epc | PC;
+	r[CTL_MA] = MA;
+	r[CTL_MB] = MB;
+	r[CTL_IR] = IR;
+	r[CTL_OV] = pdp->ov1;
+	r[CTL_PF] = pdp->pf;
+	r[CTL_SS] = pdp->ss;
+	r[CTL_TW] = pdp->tw;
+	r[CTL_TA] = pdp->eta | pdp->ta;
+	r[CTL_RUNNING] = pdp->run;
+	r[CTL_CYC] = pdp->cyc;
+	r[CTL_EXD] = pdp->exd;
+	r[CTL_SBM] = pdp->sbm;
+}
+
+static u8*
+putregs(PDP1 *pdp, u8 *p)
+{
+	u32 r[CTL_NREGS];
+	int i;
+
+	getregs(pdp, r);
+	for(i = 0; i < CTL_NREGS; i++)
+		p = put32(p, r[i]);
+	return p;
+}
+
+void
+initview(PDP1 *pdp)
+{
+	View *v;
+
+	v = pdp->view = createseg(VIEW_FILE, sizeof(View));
+	if(v == nil)
+		return;
+	memset(v, 0, sizeof(View));
+	v->version = VIEW_VERSION;
+	v->size = sizeof(View);
+	v->pid = getpid();
+	__atomic_store_n(&v->magic, VIEW_MAGIC, __ATOMIC_RELEASE);
+}
+
+static void
+beginview(u32 *seq)
+{
+	__atomic_store_n(seq, *seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+endview(u32 *seq)
+{
+	__atomic_store_n(seq, *seq+1, __ATOMIC_RELEASE);
+}
+
+// let the tools see what we're doing, see pdp1view.h
+void
+publishview(PDP1 *pdp)
+{
+	View *v = pdp->view;
+	u64 now;
+
+	if(v == nil || pdp->simtime < pdp->view_time)
+		return;
+	pdp->view_time = pdp->simtime + VIEWQ;
+
+	beginview(&v->rseq);
+	v->simtime = pdp->simtime;
+	v->power = pdp->power_sw;
+	getregs(pdp, v->regs);
+	v->sbreq = pdp->b2;
+	v->sbon = pdp->b1;
+	v->rb = pdp->rb;
+	v->rpos = pdp->r_tape ? pdp->r_tpos : -1;
+	v->pb = pdp->pb;
+	v->tb = pdp->tb;
+	v->tbs = pdp->tbs;
+	v->tyo = pdp->tyo;
+	endview(&v->rseq);
+
+	now = gettime();
+	if(now - pdp->view_ctime >= VIEWCORE) {
+		pdp->view_ctime = now;
+		beginview(&v->cseq);
+		v->ctime = pdp->simtime;
+		memcpy(v->core, pdp->core, sizeof(pdp->core));
+		endview(&v->cseq);
+	}
+}
+
+// what the start (or continue) key does, the address instead
+// of the address switches
+static void
+startkey(PDP1 *pdp, int start, Word a)
+{
+	bool sw[4] = { pdp->start_sw, pdp->continue_sw,
+		pdp->examine_sw, pdp->deposit_sw };
+	Word ta = pdp->ta, eta = pdp->eta;
+
+	pdp->start_sw = start;
+	pdp->continue_sw = !start;
+	pdp->examine_sw = pdp->deposit_sw = 0;
+	pdp->ta = a & ADDRMASK;
+	pdp->eta = a & EXTMASK;
+	spec(pdp);
+	cycle(pdp);
+	pdp->start_sw = sw[0];
+	pdp->continue_sw = sw[1];
+	pdp->examine_sw = sw[2];
+	pdp->deposit_sw = sw[3];
+	pdp->ta = ta;
+	pdp->eta = eta;
+}
+
+// one instruction, like continue with the single instruction switch.
+// give up if an IOT keeps us waiting too long.
+static void
+step(PDP1 *pdp)
+{
+	int sw, n;
+
+	sw = pdp->single_inst_sw;
+	pdp->single_inst_sw = 1;
+	startkey(pdp, 0, 0);
+	for(n = 0; pdp->run && n < 100000; n++) {
+		cycle(pdp);
+		handleio(pdp);
+		pdp->simtime += 5000;
+	}
+	pdp->run = 0;
+	pdp->single_inst_sw = sw;
+}
+
+// binary control request, see ctlproto.h
+void
+ctlcmd(PDP1 *pdp, Cmd *c)
+{
+	static u8 out[CTL_HDRSZ + 4*CTL_MAXWORDS];
+	u8 *p;
+	u32 a, n, i;
+	int st;
+
+	p = out + CTL_HDRSZ;
+	st = CTL_OK;
+	switch(c->op) {
+	case CTL_READ:
+		if(c->len != 8) {
+			st = CTL_ELEN;
+			break;
+		}
+		a = get32(c->data);
+		n = get32(c->data+4);
+		if(n > CTL_MAXWORDS) {
+			st = CTL_ELEN;
+			break;
+		}
+		if(a >= MAXMEM || n > MAXMEM-a) {
+			st = CTL_EADDR;
+			break;
+		}
+		for(i = 0; i < n; i++)
+			p = put32(p, pdp->core[a+i]);
+		break;
+
+	case CTL_WRITE:
+		if(c->len < 4 || c->len%4) {
+			st = CTL_ELEN;
+			break;
+		}
+		a = get32(c->data);
+		n = (c->len-4)/4;
+		if(a >= MAXMEM || n > MAXMEM-a) {
+			st = CTL_EADDR;
+			break;
+		}
+		for(i = 0; i < n; i++)
+			pdp->core[a+i] = get32(c->data+4+4*i) & WORDMASK;
+		break;
+
+	case CTL_REGS:
+		p = putregs(pdp, p);
+		break;
+
+	case CTL_RUN:
+		if(c->len != 0 && c->len != 4) {
+			st = CTL_ELEN;
+			break;
+		}
+		if(!pdp->power_sw) {
+			st = CTL_EPOWER;
+			break;
+		}
+		if(!pdp->run)
+			startkey(pdp, c->len == 4, c->len == 4 ? get32(c->data) : 0);
+		break;
+
+	case CTL_STOP:
+		pdp->run_enable = 0;
+		break;
+
+	case CTL_STEP:
+		if(!pdp->power_sw) {
+			st = CTL_EPOWER;
+			break;
+		}
+		if(!pdp->run)
+			step(pdp);
+		p = putregs(pdp, p);
+		break;
+
+	case CTL_TEXT:
+		n = c->len;
+		if(n >= sizeof(c->line))
+			n = sizeof(c->line)-1;
+		memcpy(c->line, c->data, n);
+		c->line[n] = '\0';
+		n = strlen(strcpy((char*)p, handlecmd(pdp, c->line)));
+		p += n;
+		break;
+
+	default:
+		st = CTL_EOP;
+		break;
+	}
+
+	n = p - out;
+	out[0] = CTL_MAGIC;
+	out[1] = st;
+	out[2] = c->tag;
+	out[3] = c->tag>>8;
+	put32(out+4, n - CTL_HDRSZ);
+	netreply(c, out, n);
+}
+
 char*
 handlecmd(PDP1 *pdp, char *line)
 {
 	int n;
-	static char resp[1024];
+	static char resp[4096];
 	char *p;
 
 	if(p = strchr(line, '\r'), p) *p = '\0';
@@ -1648,42 +2167,69 @@ handlecmd(PDP1 *pdp, char *line)
 		// reader
 		if(strcmp(args[0], "r") == 0) {
 			close(pdp->r_fd);
-			pdp->r_fd = -1;
+			setreader(pdp, -1, PTR_FILE);
 			if(args[1]) {
-				pdp->r_fd = open(args[1], O_RDONLY);
-				if(pdp->r_fd < 0)
+				TapeImage *t = tapeopen(args[1]);
+				if(t == nil)
 					sprintf(resp, "couldn't open %s", args[1]);
+				else {
+					mounttape(pdp, t);
+					if(args[2] && strcmp(args[2], "fast") == 0)
+						pdp->r_fast = 1;
+				}
 			}
 		}
 		// punch
 		else if(strcmp(args[0], "p") == 0) {
-			close(pdp->p_fd);
-			pdp->p_fd = -1;
+			int fd = -1;
 			if(args[1]) {
-				pdp->p_fd = open(args[1], O_CREAT|O_WRONLY|O_TRUNC, 0644);
-				if(pdp->p_fd < 0)
+				fd = open(args[1], O_CREAT|O_WRONLY|O_TRUNC, 0644);
+				if(fd < 0)
 					sprintf(resp, "couldn't open %s", args[1]);
 			}
+			setpunch(pdp, fd);
 		}
 		// load
 		else if(strcmp(args[0], "l") == 0) {
 			static char *rimfile = nil;
-			int fd;
 			if(args[1]) {
 				free(rimfile);
 				rimfile = strdup(args[1]);
 			}
 			if(rimfile) {
-				fd = open(rimfile, O_RDONLY);
-				if(fd < 0) {
+				TapeImage *t = tapeopen(rimfile);
+				if(t == nil)
 					sprintf(resp, "couldn't open %s", rimfile);
-				} else {
-					readrim(pdp, fd);
-					close(fd);
+				else {
+					loadtape(pdp, t, resp);
+					tapeclose(t);
 				}
 			} else
 				sprintf(resp, "no filename");
 		}
+		// tape library
+		else if(strcmp(args[0], "tapes") == 0)
+			listtapes(resp, sizeof(resp)-2, args[1] ? args[1] : "tapes");
+		// sequence break counters
+		else if(strcmp(args[0], "sbs") == 0) {
+			int ch;
+			if(args[1] && strcmp(args[1], "clear") == 0) {
+				memset(pdp->sbreqs, 0, sizeof(pdp->sbreqs));
+				memset(pdp->sbbreaks, 0, sizeof(pdp->sbbreaks));
+			}
+			p = resp;
+			p += sprintf(p, "sbs16 %d on %06o req %06o held %06o", pdp->sbs16, pdp->b1, pdp->b2, pdp->b4);
+			for(ch = 0; ch < 16; ch++)
+				if(pdp->sbreqs[ch] || pdp->sbbreaks[ch])
+					p += sprintf(p, "\nchan %2o  requests %u  breaks %u", ch, pdp->sbreqs[ch], pdp->sbbreaks[ch]);
+		}
+		// dynamic IOTs
+		else if(strcmp(args[0], "iot") == 0) {
+			if(args[1] && strcmp(args[1], "reload") == 0)
+				dynamicIotReload(args[2] ? strtol(args[2], nil, 8) : -1, resp, sizeof(resp)-2);
+			else
+				dynamicIotList(resp, sizeof(resp)-2);
+		}
 		// display
 		else if(strcmp(args[0], "d") == 0) {
 			static const char *host = "localhost";
@@ -1693,27 +2239,68 @@ handlecmd(PDP1 *pdp, char *line)
 			if(args[2])
 				port = atoi(args[2]);
 
-			if(pdp->dpy[0].fd >= 0)
-				close(pdp->dpy[0].fd);
-			pdp->dpy[0].last = pdp->simtime;
-			pdp->dpy[0].fd = dial(host, port);
-			if(pdp->dpy[0].fd < 0)
+			int fd = dial(host, port);
+			if(fd < 0)
 				strcpy(resp, "can't open display");
-			else
-				nodelay(pdp->dpy[0].fd);
+			else if(connectdpy(pdp, 0, fd) < 0) {
+				close(fd);
+				strcpy(resp, "too many displays");
+			}
+		}
+		// display routing
+		else if(strcmp(args[0], "dpymode") == 0) {
+			static const char *modes[] = { "auto", "single", "mirror", "split" };
+			u32 i;
+			if(args[1]) {
+				for(i = 0; i < nelem(modes); i++)
+					if(strcmp(args[1], modes[i]) == 0)
+						break;
+				if(i < nelem(modes)) {
+					pdp->dpymode = i;
+					pdp->dpyreconf = 1;
+				} else
+					sprintf(resp, "unknown mode %s", args[1]);
+			}
+			if(args[1] == nil || i < nelem(modes))
+				sprintf(resp, "display mode %s", modes[pdp->dpymode]);
+		}
+		// display recorder
+		else if(strcmp(args[0], "dpyrec") == 0) {
+			disconnectdpy(pdp, 0, SINK_REC);
+			disconnectdpy(pdp, 1, SINK_REC);
+			if(args[1]) {
+				int i = args[2] ? atoi(args[2]) != 0 : 0;
+				FILE *f = fopen(args[1], "wb");
+				if(f == nil)
+					sprintf(resp, "couldn't open %s", args[1]);
+				else if(recorddpy(pdp, i, f) < 0) {
+					fclose(f);
+					strcpy(resp, "no free display sink");
+				}
+			}
 		}
 		// help
 		else if(strcmp(args[0], "?") == 0 ||
 			strcmp(args[0], "help") == 0) {
 			p = resp;
 			p += sprintf(p, "r                     unmount tape from reader\n");
-			p += sprintf(p, "r filename            mount tape in reader\n");
+			p += sprintf(p, "r filename [fast]     mount tape in reader, fast loads it unthrottled\n");
 			p += sprintf(p, "p                     unmount tape from punch\n");
 			p += sprintf(p, "p filename            mount tape in punch\n");
-			p += sprintf(p, "l filename            load memory from RIM-file\n");
+			p += sprintf(p, "l filename            load RIM, BIN or AM1 tape into memory\n");
+			p += sprintf(p, "tapes [dir]           list tapes with format and start address\n");
+			p += sprintf(p, "sbs [clear]           sequence break state and counts per channel\n");
+			p += sprintf(p, "iot                   list loaded IOT handlers\n");
+			p += sprintf(p, "iot reload [nn]       reload handler for IOT nn (octal), or all of them\n");
 			p += sprintf(p, "d [host] [port]       connect to display program\n");
-			p += sprintf(p, "muldiv [on/off]       set/toggle type 10 mul-div option");
-			p += sprintf(p, "audio [on/off]        set/toggle audio output");
+			p += sprintf(p, "dpymode [mode]        auto, single, mirror or split by intensity bit\n");
+			p += sprintf(p, "dpyrec [file [0/1]]   record display to file, stop without args\n");
+			p += sprintf(p, "muldiv [on/off]       set/toggle type 10 mul-div option\n");
+			p += sprintf(p, "audio [on/off]        set/toggle audio output\n");
+			p += sprintf(p, "audio wav [file [rate]] record audio to wav file, stop without file\n");
+			p += sprintf(p, "fast [on/off]         set/toggle running faster than real time\n");
+			p += sprintf(p, "fastload [on/off]     set/toggle loading every tape fast\n");
+			p += sprintf(p, "paste [on/off]        set/toggle short delay between queued typed characters");
 		}
 		else if(strcmp(args[0], "muldiv") == 0) {
 			if(args[1]) {
@@ -1728,6 +2315,34 @@ handlecmd(PDP1 *pdp, char *line)
 				pdp->muldiv_sw = !pdp->muldiv_sw;
 			sprintf(resp, "mul-div now %s", pdp->muldiv_sw ? "on" : "off");
 		}
+		else if(strcmp(args[0], "fast") == 0) {
+			int on = !(pdp->fast&FAST_CMD);
+			if(args[1])
+				on = strcmp(args[1], "on") == 0 ||
+					strcmp(args[1], "1") == 0;
+			// the emulator changes FAST_LOAD behind our back
+			if(on)
+				__atomic_or_fetch(&pdp->fast, FAST_CMD, __ATOMIC_RELAXED);
+			else
+				__atomic_and_fetch(&pdp->fast, ~FAST_CMD, __ATOMIC_RELAXED);
+			sprintf(resp, "fast now %s", on ? "on" : "off");
+		}
+		else if(strcmp(args[0], "fastload") == 0) {
+			if(args[1])
+				pdp->fastload = strcmp(args[1], "on") == 0 ||
+					strcmp(args[1], "1") == 0;
+			else
+				pdp->fastload = !pdp->fastload;
+			sprintf(resp, "fastload now %s", pdp->fastload ? "on" : "off");
+		}
+		else if(strcmp(args[0], "paste") == 0) {
+			if(args[1])
+				pdp->typ_paste = strcmp(args[1], "on") == 0 ||
+					strcmp(args[1], "1") == 0;
+			else
+				pdp->typ_paste = !pdp->typ_paste;
+			sprintf(resp, "paste now %s", pdp->typ_paste ? "on" : "off");
+		}
 		else if(strcmp(args[0], "audio") == 0) {
             resp[0] = '\0';
 			if(args[1]) {
@@ -1755,6 +2370,18 @@ handlecmd(PDP1 *pdp, char *line)
 				else if(strcmp(args[1], "tuning") == 0 )
                 {
                     setAudioTuning(atof(args[2]));
+                }
+				else if(strcmp(args[1], "wav") == 0 )
+                {
+                    if( args[2] == nil )
+                    {
+                        stopwav();
+                        strcpy(resp, "audio recording stopped");
+                    }
+                    else if( startwav(args[2], args[3] ? atoi(args[3]) : 0) < 0 )
+                        sprintf(resp, "couldn't open %s", args[2]);
+                    else
+                        sprintf(resp, "recording audio to %s", args[2]);
                 }
 			} else {
                     doaudio = !doaudio;
@@ -14,13 +14,90 @@ typedef struct Panel Panel;
 
 void updatelights(PDP1 *pdp, Panel *panel);
 
-struct DispCon
+#define DPYBUFSZ 512
+#define DPYFRAME (33333*1000)	// ns, flush at most this often
+#define MAXDPYSINK 8
+#define DPYRINGSZ (64*1024)	// output buffer per client, power of 2
+
+// display sinks
+enum {
+	SINK_NONE,
+	SINK_CLAIMED,	// being set up
+	SINK_TCP,	// display client
+	SINK_REC,	// recorder, v1 words to a file
+};
+
+// Work for the emulator thread from any other thread.
+// Posted commands are run in order between instructions.
+typedef struct NetConn NetConn;
+typedef struct Cmd Cmd;
+struct Cmd
+{
+	void (*fn)(PDP1 *pdp, Cmd *c);
+	int fd;
+	NetConn *conn;	// where replies go, see netreply()
+	char line[1024];
+	// binary request, see ctlproto.h
+	int op, tag;
+	u8 *data;
+	int len;
+	Cmd *next;
+};
+
+typedef struct DpySink DpySink;
+struct DpySink
 {
+	volatile int type;
 	int fd;
+	FILE *f;
+	int proto;	// see dpyproto.h
+	int pflags;
+	volatile int want;	// version|flags<<8 asked for by client
+	volatile int closing;	// emulator closes it at the next chance
+	// client output not written yet
+	u8 *ring;
+	u32 rhead, rtail;
+	u32 lost;	// us of dropped points, sent as an escape later
+};
+
+struct DispCon
+{
 	u64 last;
-	u32 cmdbuf[128];
+	u64 lastflush;
+	u32 cmdbuf[DPYBUFSZ];
 	u32 ncmds;
-	u32 agetime;
+	u32 maxcmds;	// flush threshold, smaller for v1 clients
+	int nsinks;
+	int backlog;	// some client has output in its ring
+	DpySink sink[MAXDPYSINK];
+	volatile u32 pen;	// last DPY_PEN word from a client
+};
+
+#define P_KEEP (-2)
+
+// reasons to run unthrottled
+#define FAST_CMD 1	// "fast" command
+#define FAST_LOAD 2	// loading a tape with "r file fast" or "fastload"
+
+// reader connections, others are ptrproto.h versions
+#define PTR_FILE 0	// local file, no protocol
+#define PTR_NET (-1)	// socket, version not known yet
+
+// display configuration
+enum {
+	DPY_AUTO,	// split if both screens are connected
+	DPY_SINGLE,	// everything on one screen
+	DPY_MIRROR,	// everything on both screens
+	DPY_SPLIT,	// intensity bit 4 selects the screen
+};
+
+// what display() does, derived from the above
+enum {
+	ROUTE_NONE,
+	ROUTE_0,
+	ROUTE_1,
+	ROUTE_MIRROR,
+	ROUTE_SPLIT,
 };
 
 struct PDP1
@@ -80,6 +157,9 @@ struct PDP1
 	u16 b2;		// req
 	u16 b3;		// req synchronized
 	u16 b4;		// break held
+	u32 sbpend;	// posted by postbreak(), any thread, folded into b2 at sbs_sync
+	u32 sbreqs[16];	// requests per channel
+	u32 sbbreaks[16];	// breaks taken per channel
 
 	// type 10, multiply-divide
 	int muldiv_sw;
@@ -96,12 +176,19 @@ struct PDP1
 
 	int cychack;	// for cycle entry past TP0
 	u64 simtime;
-	u64 realtime;
+	u64 realtime;	// wall clock in simtime terms, 0 to resync
+	u64 timeoff;
+	int fast;	// don't throttle, FAST_ bits
+	Cmd *cmdq;	// posted commands, newest first
+	struct View *view;	// shared with the tools
+	u64 view_time;	// next publish, simtime
+	u64 view_ctime;	// last core publish, real time
 
 	// display
 	int dcp;
 	int dbx, dby;
 	int dint;	// no direct schematics for this
+	int lp;		// light pen flag
 	// simulation
 //	int dpy_fd;
 //	int dpy2_fd;
@@ -110,6 +197,9 @@ struct PDP1
 //	u64 dpy_last;
 //	u64 dpy2_last;
 	DispCon dpy[2];
+	int dpymode;
+	int dpyroute;
+	volatile int dpyreconf;
 
 	// reader
 	int rcp;
@@ -121,6 +211,15 @@ struct PDP1
 	// simulation
 	int r_fd;
 	u64 r_time;
+	int r_proto;	// PTR_FILE, or ptrproto.h version, -1 until hello
+	u8 r_buf[4096];
+	int r_pos, r_n;
+	struct TapeImage *r_tape;	// mounted from the tape library, instead of r_fd
+	int r_tpos;
+	int r_credit;	// bytes taken, not confirmed yet
+	u64 r_ctime;	// when the last one was taken
+	int r_fast;	// load this tape fast
+	int fastload;	// load every tape fast
 	int rim_return;
 	int rim_cycle;		// hack to trigger read-in SP1
 
@@ -133,6 +232,10 @@ struct PDP1
 	u64 p_time;
 	u64 feed_time;
 	int p_fd;
+	int p_next;	// fd to switch to, P_KEEP if none
+	u8 p_buf[256];	// punched, not written yet
+	int p_n;
+	u64 p_ftime;	// when p_buf was last written
 
 	// typewriter
 	int tcp;
@@ -144,6 +247,8 @@ struct PDP1
 	FD typ_fd;
 	u64 typ_time;
 	u64 tyi_wait;
+	u64 poll_time;	// next look at input fds
+	int typ_paste;	// feed queued characters as fast as they're taken
 
 	// spacewar controllers
 	int spcwar1;
@@ -205,10 +310,29 @@ void start_readin(PDP1 *pdp);
 void readin1(PDP1 *pdp);
 void readin2(PDP1 *pdp);
 void handleio(PDP1 *pdp);
+void display(PDP1 *pdp);
+void dpyplot(PDP1 *pdp, int i, u32 pt);
+void flushdpy(PDP1 *pdp, int i);
 void agedisplay(PDP1 *pdp, int i);
+void dpyconfig(PDP1 *pdp);
+void initdpys(PDP1 *pdp);
+int connectdpy(PDP1 *pdp, int i, int fd);
+int recorddpy(PDP1 *pdp, int i, FILE *f);
+void disconnectdpy(PDP1 *pdp, int i, int type);
 void throttle(PDP1 *pdp);
+void setreader(PDP1 *pdp, int fd, int proto);
+void mounttape(PDP1 *pdp, struct TapeImage *t);
+void setpunch(PDP1 *pdp, int fd);
+void flushpunch(PDP1 *pdp);
 void cli(PDP1 *pdp);
 char *handlecmd(PDP1 *pdp, char *line);
+void postcmd(PDP1 *pdp, Cmd *c);
+void postbreak(PDP1 *pdp, int chan);
+void runcmds(PDP1 *pdp);
+void ctlcmd(PDP1 *pdp, Cmd *c);
+void netreply(Cmd *c, const void *p, int n);
+void initview(PDP1 *pdp);
+void publishview(PDP1 *pdp);
 
 void typtelnet(int port, int fd);
 
@@ -224,4 +348,8 @@ void setMixerGain(float);
 float getMixerGain(void);
 void setAudioTuning(float);
 float getAudioTuning(void);
+void svc_wav(PDP1 *pdp);
+int startwav(const char *file, int rate);
+void stopwav(void);
 extern int doaudio;
+extern int recaudio;
@@ -0,0 +1,67 @@
+// live read-only view of the emulated machine
+//
+// The emulator keeps VIEW_FILE up to date, tools attachseg() it and
+// read whatever they like without asking the emulator. Registers and
+// device status are published every ms of simulated time, core every
+// frame. Each part has its own sequence number, odd while the emulator
+// is writing it: copy the part out between two reads of an even and
+// unchanged sequence number and the copy is consistent, see viewcopy().
+// Check magic and version before trusting anything else.
+
+#include <stdint.h>
+#include <string.h>
+#include "ctlproto.h"
+
+#define VIEW_FILE "/tmp/pdp1_view"
+#define VIEW_MAGIC 0x56315044	// "DP1V"
+#define VIEW_VERSION 1
+#define VIEW_MEMSZ 0200000
+
+typedef struct View View;
+struct View
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;		// sizeof(View)
+	uint32_t pid;		// of the emulator
+
+	// registers and devices
+	uint32_t rseq;
+	uint64_t simtime;	// ns
+	uint32_t power;
+	uint32_t regs[CTL_NREGS];	// same as CTL_REGS
+	uint32_t sbreq;		// sequence break channels requested
+	uint32_t sbon;		// channels on (type 20)
+	uint32_t rb;		// reader buffer
+	int32_t rpos;		// position in the mounted tape, -1 if none
+	uint32_t pb;		// punch buffer
+	uint32_t tb;		// typewriter buffer
+	uint32_t tbs;		// typed character waiting for tyi
+	uint32_t tyo;		// typing out
+
+	// core
+	uint32_t cseq;
+	uint64_t ctime;		// simtime of the copy
+	uint32_t core[VIEW_MEMSZ];
+};
+
+// copy n bytes of a part of the view guarded by seq, 0 on success.
+// retry later if the emulator kept writing.
+static inline int
+viewcopy(const uint32_t *seq, void *dst, const void *src, size_t n)
+{
+	uint32_t s1, s2;
+	int try;
+
+	for(try = 0; try < 100; try++) {
+		s1 = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		if(s1 & 1)
+			continue;
+		memcpy(dst, src, n);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		s2 = __atomic_load_n(seq, __ATOMIC_RELAXED);
+		if(s1 == s2)
+			return 0;
+	}
+	return -1;
+}
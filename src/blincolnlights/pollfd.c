@@ -1,143 +1,145 @@
 #include <unistd.h>
 #include <fcntl.h>
-#include <pthread.h>
-#include <poll.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include "common.h"
 
-struct FDmsg
-{
-	int msg;
-	FD *fd;
-};
+/*
+ * One epoll set for all input fds, checked by whoever runs the
+ * machine, between instructions or while it sleeps. No thread.
+ * Each fd is armed one-shot: once it is readable we read as much
+ * as fits into its buffer and only arm it again when the buffer
+ * is used up, so a character costs no syscalls of its own.
+ * Other threads can cut a sleep short with pollwake().
+ */
 
-static FD *fds[100];
-static struct pollfd pfds[100];
-static int nfds;
-static int pollpipe[2] = { -1, -1 };
+static int epfd = -1;
+static int wakefd = -1;
 
-static void
-removeslot(int i)
+void
+startpolling(void)
 {
-	pfds[i].revents = 0;
-	pfds[i].events = 0;
-	pfds[i].fd = -1;
-	fds[i]->fd = -1;
-	fds[i]->id = -1;
-	fds[i]->ready = 0;
-	fds[i] = nil;
+	struct epoll_event ev;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	wakefd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.ptr = nil;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
 }
 
 static void
-pollfds(void)
+armfd(FD *fd, int op)
 {
-	struct FDmsg msg;
-	FD *fd;
-	int i, n;
+	struct epoll_event ev;
 
-	pipe(pollpipe);
-	pfds[0].fd = pollpipe[0];
-	pfds[0].events = POLLIN;
-	nfds = 1;
-	for(;;) {
-		n = poll(pfds, nfds, -1);
-		if(n < 0) {
-			perror("error poll");
-			return;
-		}
-
-		/* someone wants us to watch their fd or has closed it */
-		if(pfds[0].revents & POLLIN) {
-			read(pfds[0].fd, &msg, sizeof(msg));
-			fd = msg.fd;
-			switch(msg.msg) {
-			// wait
-			case 1:
-				if(fd->id >= 0) {
-					/* already in list */
-					assert(fds[fd->id] == fd);
-//printf("polling fd %d in slot %d\n", fd->fd, fd->id);
-				} else {
-					/* add to list */
-					for(i = 1; i < nfds; i++)
-						if(fds[i] == nil)
-							break;
-					assert(i < nelem(pfds));
-					if(i == nfds) nfds++;
-					fd->id = i;
-					fds[fd->id] = fd;
-//printf("adding fd %d in slot %d\n", fd->fd, fd->id);
-				}
-				pfds[fd->id].fd = fd->fd;
-				pfds[fd->id].events = POLLIN;
-				pfds[fd->id].revents = 0;
-				fd->ready = 0;
-				break;
-
-			// close
-			case 2:
-				/* fd was closed */
-//printf("received close for fd %d slot %d\n", pfds[fd->id].fd, fd->id);
-				assert(fd->id >= 0);
-				close(pfds[fd->id].fd);
-				removeslot(fd->id);
-				break;
-			}
-		}
-
-		for(i = 1; i < nfds; i++) {
-			/* fd was closed on other side */
-			if(pfds[i].revents & POLLHUP) {
-//printf("fd %d hung up\n", pfds[i].fd);
-				close(fds[i]->fd);
-				removeslot(i);
-			}
-			if(pfds[i].revents & POLLIN) {
-//printf("fd %d became ready\n", pfds[i].fd);
-				/* ignore this fd for now */
-				pfds[i].fd = -1;
-				pfds[i].events = 0;
-				pfds[i].revents = 0;
-				fds[i]->ready = 1;
-			}
-			if(pfds[i].revents)
-				printf("more events on fd %d: %d\n", pfds[i].fd, pfds[i].revents);
-		}
-	}
+	ev.events = EPOLLIN|EPOLLONESHOT;
+	ev.data.ptr = fd;
+	if(epoll_ctl(epfd, op, fd->fd, &ev) < 0)
+		perror("epoll_ctl");
 }
 
-static void *pollthread(void *arg) { pollfds(); return nil; }
+// start watching fd
+void
+waitfd(FD *fd)
+{
+	fd->pos = fd->n = 0;
+	fd->eof = 0;
+	fd->id = -1;
+	if(fd->fd < 0)
+		return;
+	armfd(fd, EPOLL_CTL_ADD);
+	fd->id = fd->fd;
+}
 
 void
-startpolling(void)
+closefd(FD *fd)
 {
-	pthread_t th;
-	pthread_create(&th, nil, pollthread, nil);
+	if(fd->fd < 0)
+		return;
+	printf("closing fd %d\n", fd->fd);
+	if(fd->id >= 0)
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd->fd, nil);
+	close(fd->fd);
+	fd->fd = -1;
+	fd->id = -1;
+	fd->pos = fd->n = 0;
+	fd->eof = 0;
+}
 
-	// wait for thread to start so waitfd can do its thing
-	while(((volatile int*)pollpipe)[0] < 0) usleep(1000);
+// stop watching, the fd stays open
+void
+unwatchfd(FD *fd)
+{
+	if(fd->id >= 0)
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd->fd, nil);
+	fd->id = -1;
 }
 
+// fds with a ready function are only reported once until this
 void
-waitfd(FD *fd)
+rearmfd(FD *fd)
 {
-	struct FDmsg msg;
-	if(fd->fd < 0)
+	if(fd->id >= 0)
+		armfd(fd, EPOLL_CTL_MOD);
+}
+
+static void
+fillfd(FD *fd)
+{
+	int n;
+
+	n = read(fd->fd, fd->buf, sizeof(fd->buf));
+	if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		armfd(fd, EPOLL_CTL_MOD);
 		return;
-	fd->ready = 0;
-	msg.msg = 1;
-	msg.fd = fd;
-	write(pollpipe[1], &msg, sizeof(msg));
+	}
+	if(n <= 0) {
+		fd->eof = 1;
+		return;
+	}
+	fd->pos = 0;
+	fd->n = n;
 }
 
+// collect what became readable, waiting up to ms for something to
 void
-closefd(FD *fd)
+pollfds(int ms)
 {
-	struct FDmsg msg;
-	printf("closing fd %d\n", fd->fd);
-	int i = fd->id;
-	msg.msg = 2;
-	msg.fd = fd;
-	write(pollpipe[1], &msg, sizeof(msg));
-	// wait for thread to notice
-	while(((volatile FD**)fds)[i] != nil) usleep(1);
+	struct epoll_event ev[16];
+	u64 x;
+	int i, n;
+
+	n = epoll_wait(epfd, ev, nelem(ev), ms);
+	for(i = 0; i < n; i++) {
+		if(ev[i].data.ptr == nil)
+			read(wakefd, &x, sizeof(x));
+		else if(((FD*)ev[i].data.ptr)->ready)
+			((FD*)ev[i].data.ptr)->ready(ev[i].data.ptr);
+		else
+			fillfd(ev[i].data.ptr);
+	}
+}
+
+// any thread
+void
+pollwake(void)
+{
+	u64 x = 1;
+	write(wakefd, &x, sizeof(x));
+}
+
+// next buffered character, -1 if none, -2 at end of file
+int
+fdgetc(FD *fd)
+{
+	int c;
+
+	if(fd->pos >= fd->n)
+		return fd->eof ? -2 : -1;
+	c = fd->buf[fd->pos++];
+	if(fd->pos == fd->n && fd->fd >= 0)
+		armfd(fd, EPOLL_CTL_MOD);
+	return c;
 }
@@ -0,0 +1,19 @@
+// paper tape reader protocol on port 1042
+//
+// v1: the peripheral sends one tape byte and waits, the emulator
+// echoes it when the reader has taken it, then comes the next byte.
+// That's a network round trip per character.
+//
+// v2: the peripheral opens with PTR_HELLO, PTR_VERSION and then sends
+// tape bytes up to PTR_WINDOW ahead of the position the emulator has
+// confirmed. The emulator confirms with credit bytes, each the number
+// (1-255) of tape bytes taken since the last credit. Credits go out
+// every PTR_BATCH bytes, or PTR_SYNC ms after a byte was taken, so the
+// tape position display on the peripheral doesn't lag behind.
+// A v1 tape that happens to start with PTR_HELLO will confuse the emulator.
+
+#define PTR_HELLO 0376
+#define PTR_VERSION 2
+#define PTR_WINDOW 256
+#define PTR_BATCH 32
+#define PTR_SYNC 20
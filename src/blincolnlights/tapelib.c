@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "tapelib.h"
+
+/*
+ * tape images with an index, see tapelib.h
+ */
+
+#define DIO 0320000
+#define JMP 0600000
+#define OPMASK 0760000
+#define EEM 0724074	// first instruction of the AM1 loader
+#define RPB 0730002	// first instruction of the DDT BIN loader
+
+static pthread_mutex_t tapelock = PTHREAD_MUTEX_INITIALIZER;
+static TapeImage *tapes;
+
+// 18 bits from three characters with 0200 punched, like rpb.
+// -1 at the end of the tape
+int
+tapeword(const TapeImage *t, int *pos)
+{
+	int w, i, p;
+
+	w = 0;
+	p = *pos;
+	for(i = 0; i < 3; i++) {
+		while(p < t->n && (t->p[p]&0200) == 0)
+			p++;
+		if(p >= t->n)
+			return -1;
+		w = w<<6 | (t->p[p++]&077);
+	}
+	*pos = p;
+	return w;
+}
+
+// offset of the next word, skipping unpunched characters
+static int
+wordpos(const TapeImage *t, int pos)
+{
+	while(pos < t->n && (t->p[pos]&0200) == 0)
+		pos++;
+	return pos;
+}
+
+static int
+onesadd(int a, int b)
+{
+	a += b;
+	if(a & 01000000)
+		a = (a & 0777777) + 1;
+	return a;
+}
+
+static TapeBlock*
+addblk(TapeImage *t, int type, int off, int addr)
+{
+	TapeBlock *b;
+
+	if((t->nblk & 15) == 0)
+		t->blk = realloc(t->blk, (t->nblk+16)*sizeof(TapeBlock));
+	b = &t->blk[t->nblk++];
+	memset(b, 0, sizeof(*b));
+	b->type = type;
+	b->off = off;
+	b->addr = addr;
+	return b;
+}
+
+static void
+indexbin(TapeImage *t, int pos)
+{
+	TapeBlock *b;
+	int off, w, end, sum, i;
+
+	for(;;) {
+		off = wordpos(t, pos);
+		if((w = tapeword(t, &pos)) < 0) {
+			snprintf(t->err, sizeof(t->err), "no start address on tape");
+			return;
+		}
+		if((w&OPMASK) == JMP) {
+			t->start = w&07777;
+			return;
+		}
+		end = tapeword(t, &pos);
+		if((w&OPMASK) != DIO || end < 0 || (end&OPMASK) != DIO ||
+		   (end&07777) < (w&07777)) {
+			snprintf(t->err, sizeof(t->err), "bad BIN block: %06o", w);
+			return;
+		}
+		b = addblk(t, BLK_BIN, off, w&07777);
+		b->n = (end&07777) - (w&07777);
+		sum = onesadd(w, end);
+		for(i = 0; i < b->n; i++) {
+			if((w = tapeword(t, &pos)) < 0) {
+				snprintf(t->err, sizeof(t->err),
+					"tape ends in BIN block %04o", b->addr);
+				t->nblk--;
+				return;
+			}
+			sum = onesadd(sum, w);
+		}
+		b->sumok = tapeword(t, &pos) == sum;
+		if(!b->sumok)
+			t->badsum++;
+	}
+}
+
+static void
+indexam1(TapeImage *t, int pos)
+{
+	TapeBlock *b;
+	int off, w, end;
+
+	for(;;) {
+		off = wordpos(t, pos);
+		if((w = tapeword(t, &pos)) < 0) {
+			snprintf(t->err, sizeof(t->err), "no start address on tape");
+			return;
+		}
+		if((w&0600000) == 0600000)
+			return;		// halt, no start
+		if(w&0400000) {
+			t->start = w&0177777;
+			return;
+		}
+		end = tapeword(t, &pos);
+		if(end < 0 || end > 0200000 || end < (w&0177777)) {
+			snprintf(t->err, sizeof(t->err), "bad AM1 block: %06o", w);
+			return;
+		}
+		b = addblk(t, BLK_AM1, off, w&0177777);
+		b->n = end - b->addr;
+		pos = off;
+		for(w = 0; w < b->n+2; w++)
+			if(tapeword(t, &pos) < 0) {
+				snprintf(t->err, sizeof(t->err), "tape ends in AM1 block");
+				t->nblk--;
+				return;
+			}
+	}
+}
+
+static void
+indextape(TapeImage *t)
+{
+	TapeBlock *b;
+	int *rim;
+	int pos, off, w, d;
+
+	t->start = -1;
+	for(t->leader = 0; t->leader < t->n; t->leader++)
+		if(t->p[t->leader])
+			break;
+
+	// RIM, anything before the first dio is ignored by read-in
+	pos = 0;
+	do {
+		off = wordpos(t, pos);
+		w = tapeword(t, &pos);
+	} while(w >= 0 && (w&OPMASK) != DIO);
+	if(w < 0)
+		return;
+	rim = malloc(010000*sizeof(int));
+	memset(rim, 0xFF, 010000*sizeof(int));
+	b = addblk(t, BLK_RIM, off, 0);
+	while((w&OPMASK) == DIO) {
+		if((d = tapeword(t, &pos)) < 0)
+			break;
+		rim[w&07777] = d;
+		b->n++;
+		w = tapeword(t, &pos);
+	}
+	if(w < 0 || (w&OPMASK) != JMP) {
+		if(w < 0)
+			snprintf(t->err, sizeof(t->err), "no start address on tape");
+		else
+			snprintf(t->err, sizeof(t->err), "rim botch: %06o", w);
+		free(rim);
+		return;
+	}
+	t->format = TAPE_RIM;
+	t->start = w&07777;
+
+	// RIM started a loader, the blocks that follow are for it
+	if(rim[t->start] == RPB) {
+		t->format = TAPE_BIN;
+		t->start = -1;
+		indexbin(t, pos);
+	} else if(rim[t->start] == EEM) {
+		t->format = TAPE_AM1;
+		t->start = -1;
+		indexam1(t, pos);
+	}
+	free(rim);
+}
+
+static void
+freetape(TapeImage *t)
+{
+	free((void*)t->p);
+	free(t->blk);
+	free(t->file);
+	free(t);
+}
+
+// the whole file, n is what we got if it shrank meanwhile
+static uint8_t*
+readtape(int fd, int *n)
+{
+	uint8_t *p;
+	int got, r;
+
+	if((p = malloc(*n)) == NULL)
+		return NULL;
+	for(got = 0; got < *n; got += r)
+		if((r = read(fd, p+got, *n-got)) <= 0)
+			break;
+	if(got == 0) {
+		free(p);
+		return NULL;
+	}
+	*n = got;
+	return p;
+}
+
+// drop changed images and all but the newest TAPECACHE that
+// aren't mounted, the list is newest first. tapelock held.
+static void
+trimcache(void)
+{
+	TapeImage *t, **tp;
+	struct stat st;
+	int n;
+
+	n = 0;
+	for(tp = &tapes; (t = *tp) != NULL; ) {
+		if(t->refs == 0 &&
+		   (++n > TAPECACHE || stat(t->file, &st) < 0 ||
+		    st.st_dev != t->dev || st.st_ino != t->ino ||
+		    st.st_mtime != t->mtime || st.st_size != t->n)) {
+			*tp = t->next;
+			freetape(t);
+			continue;
+		}
+		tp = &t->next;
+	}
+}
+
+TapeImage*
+tapeopen(const char *file)
+{
+	TapeImage *t, **tp;
+	struct stat st;
+	uint8_t *p;
+	int fd, n;
+
+	if((fd = open(file, O_RDONLY)) < 0)
+		return NULL;
+	if(fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&tapelock);
+	for(tp = &tapes; (t = *tp) != NULL; tp = &t->next)
+		if(t->dev == st.st_dev && t->ino == st.st_ino &&
+		   t->mtime == st.st_mtime && t->n == st.st_size) {
+			// to the front, it's the newest now
+			*tp = t->next;
+			goto found;
+		}
+
+	n = st.st_size;
+	if((p = readtape(fd, &n)) == NULL) {
+		pthread_mutex_unlock(&tapelock);
+		close(fd);
+		return NULL;
+	}
+	t = calloc(1, sizeof(TapeImage));
+	t->file = strdup(file);
+	t->p = p;
+	t->n = n;
+	t->dev = st.st_dev;
+	t->ino = st.st_ino;
+	t->mtime = st.st_mtime;
+	indextape(t);
+found:
+	t->next = tapes;
+	tapes = t;
+	t->refs++;
+	trimcache();
+	pthread_mutex_unlock(&tapelock);
+	close(fd);
+	return t;
+}
+
+// the image stays cached
+void
+tapeclose(TapeImage *t)
+{
+	if(t == NULL)
+		return;
+	pthread_mutex_lock(&tapelock);
+	t->refs--;
+	pthread_mutex_unlock(&tapelock);
+}
+
+const char*
+tapeformat(const TapeImage *t)
+{
+	static const char *names[] = { "raw", "rim", "bin", "am1" };
+	return names[t->format];
+}
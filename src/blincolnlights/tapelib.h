@@ -0,0 +1,67 @@
+// tape library shared by the emulator and the tape peripherals
+//
+// Tape images are read into memory once, a tape is a few hundred KB
+// at most, and a mounted tape can't change or go away under the
+// reader when its file is rewritten. Each image gets an index on first
+// open: where the leader ends, the RIM, BIN and AM1 loader blocks
+// (see Tools/Disassembler/disassemble_tape.c), their checksums and
+// the start address. Images stay cached by file until the file
+// changes, so mounting a tape again is free. Only the TAPECACHE most
+// recently opened tapes that aren't mounted are kept.
+
+#include <stdint.h>
+#include <sys/types.h>
+
+enum {
+	TAPE_RAW,	// no RIM block
+	TAPE_RIM,	// RIM only, or RIM starting a loader we don't know
+	TAPE_BIN,	// RIM DDT BIN loader, then BIN blocks
+	TAPE_AM1,	// RIM AM1 loader, then AM1 blocks
+};
+
+enum {
+	BLK_RIM,	// n dio/data pairs
+	BLK_BIN,	// n words from addr, dio start, dio end, data, checksum
+	BLK_AM1,	// n words from extended addr, start, end, data
+};
+
+typedef struct TapeBlock TapeBlock;
+struct TapeBlock
+{
+	int type;
+	int off;	// tape offset of the first word
+	int addr;
+	int n;
+	int sumok;	// BIN checksum right
+};
+
+typedef struct TapeImage TapeImage;
+struct TapeImage
+{
+	char *file;
+	const uint8_t *p;
+	int n;
+
+	// index
+	int leader;	// offset of the first punched character
+	int format;
+	int start;	// start address, -1 if none
+	int nblk;
+	TapeBlock *blk;
+	int badsum;	// number of BIN blocks with a bad checksum
+	char err[64];	// why the index ends early, "" if it doesn't
+
+	// cache
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	int refs;
+	TapeImage *next;
+};
+
+#define TAPECACHE 16
+
+TapeImage *tapeopen(const char *file);
+void tapeclose(TapeImage *t);
+int tapeword(const TapeImage *t, int *pos);
+const char *tapeformat(const TapeImage *t);
@@ -1,5 +1,7 @@
 #include "common.h"
 #include "args.h"
+#include "ptrproto.h"
+#include "tapelib.h"
 #include <SDL2/SDL.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,6 +14,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
 
 #include <poll.h>
@@ -25,14 +28,19 @@ SDL_Window *window;
 #define GAP 20
 
 
-unsigned char *ptrbuf;
+const unsigned char *ptrbuf;
+TapeImage *ptrtape;
+// held while drawing from ptrbuf and while swapping it
+pthread_mutex_t ptrlock = PTHREAD_MUTEX_INITIALIZER;
 int ptrbuflen;
 int *ptpbuf;
 int ptpbuflen;
 
+int ptphead;	// ptpbuf is a ring, this is where the next character goes
 int ptpfd = -1;
 
-int ptrpos;
+int ptrpos;	// confirmed by the emulator
+int ptrsent;	// sent ahead of that
 
 
 // sorta temporary
@@ -45,6 +53,13 @@ drawcircle(SDL_Renderer *renderer, int cx, int cy, int r)
 			SDL_RenderDrawPoint(renderer, cx+x, cy+y);
 }
 
+// i characters back from the punch, -1 if nothing punched there
+int
+ptpchar(int i)
+{
+	return ptpbuf[(ptphead + ptpbuflen-1 - i) % ptpbuflen];
+}
+
 void
 draw(SDL_Renderer *renderer)
 {
@@ -81,6 +96,7 @@ draw(SDL_Renderer *renderer)
 
 	// reader
 	int yoff = 0;
+	pthread_mutex_lock(&ptrlock);
 	if(ptrbuflen > 0) {
 		SDL_SetRenderDrawColor(renderer, 255, 255, 176, 255);
 		rect.x = i < 0 ? -i*space : 0;
@@ -107,13 +123,14 @@ draw(SDL_Renderer *renderer)
 			if(c & 0200) drawcircle(renderer, x, yoff + 9*space, r);
 		}
 	}
+	pthread_mutex_unlock(&ptrlock);
 	yoff += height + gap;
 
 	// punch
 	if(ptpfd >= 0) {
 		SDL_SetRenderDrawColor(renderer, 255, 255, 176, 255);
 		for(i = 0; i < ptpbuflen; i++)
-			if(ptpbuf[i] < 0)
+			if(ptpchar(i) < 0)
 				break;
 		rect.x = punchpos - i*space;
 		if(rect.x < 0) rect.x = 0;
@@ -124,7 +141,7 @@ draw(SDL_Renderer *renderer)
 		i = 0;
 		for(int x = punchpos; x > -2*r; x -= space) {
 			if(i < ptpbuflen)
-				c = ptpbuf[i++];
+				c = ptpchar(i++);
 			else
 				c = 0;
 			if(c < 0)
@@ -149,43 +166,49 @@ const char *host = "localhost";
 void
 mountptr(const char *file)
 {
-	FILE *f = fopen(file, "rb");
-	if(f == nil) {
+	TapeImage *t = tapeopen(file);
+	if(t == nil) {
 		fprintf(stderr, "couldn't open file %s\n", file);
 		return;
 	}
-	fseek(f, 0, 2);
-	ptrbuflen = ftell(f);
-	fseek(f, 0, 0);
-	ptrbuf = malloc(ptrbuflen);
-	fread(ptrbuf, 1, ptrbuflen, f);
-	fclose(f);
-
-	ptrpos = 0;
-	// find beginning
-	while(ptrpos < ptrbuflen && ptrbuf[ptrpos] == 0)
-		ptrpos++;
+	pthread_mutex_lock(&ptrlock);
+	ptrtape = t;
+	ptrbuf = t->p;
+	ptrbuflen = t->n;
+	pthread_mutex_unlock(&ptrlock);
+
+	// start a bit before the leader ends
+	ptrpos = t->leader;
 	if(ptrpos > 20) ptrpos -= 10;
 }
 
 void
 unmountptr(void)
 {
-	// i'm lazy...try to mitigate race somewhat
-	static char dummy[100], *p;
+	// tapeclose may free the image, make sure
+	// the drawing code is done with it first
+	static const unsigned char dummy[100];
+	pthread_mutex_lock(&ptrlock);
 	ptrbuflen = 0;
-	p = ptrbuf;
 	ptrbuf = dummy;
-	if(p != dummy)
-		free(p);
+	pthread_mutex_unlock(&ptrlock);
+	tapeclose(ptrtape);
+	ptrtape = nil;
 }
 
+// keep PTR_WINDOW bytes ahead of what the emulator confirmed
 void
 ptrsend(int fd)
 {
-	char c;
-	c = ptrbuf[ptrpos];
-	write(fd, &c, 1);
+	int n;
+
+	n = ptrpos + PTR_WINDOW - ptrsent;
+	if(n > ptrbuflen - ptrsent)
+		n = ptrbuflen - ptrsent;
+	if(n > 0) {
+		write(fd, ptrbuf+ptrsent, n);
+		ptrsent += n;
+	}
 }
 
 void
@@ -204,7 +227,10 @@ connectptr(struct pollfd *pfd)
 		pfd->events = 0;
 		unmountptr();
 	} else {
+		u8 hello[2] = { PTR_HELLO, PTR_VERSION };
 		pfd->events = POLLIN;
+		write(pfd->fd, hello, 2);
+		ptrsent = ptrpos;
 		ptrsend(pfd->fd);
 	}
 }
@@ -222,13 +248,13 @@ initptp(void)
 	}
 	for(int i = 0; i < ptpbuflen; i++)
 		ptpbuf[i] = -1;
+	ptphead = 0;
 }
 
 void
 fileptp(const char *file)
 {
 	int fd;
-	char c;
 
 	fd = open(file, O_CREAT|O_WRONLY|O_TRUNC, 0644);
 	if(fd < 0) {
@@ -237,8 +263,9 @@ fileptp(const char *file)
 	}
 	close(ptpfd);
 	ptpfd = open("/tmp/ptpunch", O_RDONLY);
-	while(read(ptpfd, &c, 1) > 0)
-		write(fd, &c, 1);
+	// the kernel copies, no need to bring it through here
+	while(sendfile(fd, ptpfd, nil, 1<<20) > 0)
+		;
 	close(fd);
 	close(ptpfd);
 	initptp();
@@ -299,7 +326,6 @@ cli(char *line, int n)
 void*
 tapethread(void *arg)
 {
-	char c;
 	memset(pfds, 0, sizeof(pfds));
 
 	pfds[0].fd = 0;
@@ -362,26 +388,33 @@ tapethread(void *arg)
 
 		// handle reader
 		else if(pfds[1].revents & POLLIN) {
-			if(read(pfds[1].fd, &c, 1) <= 0) {
+			u8 credit[256];
+			n = read(pfds[1].fd, credit, sizeof(credit));
+			if(n <= 0) {
 				disconnectptr(&pfds[1]);
 				unmountptr();
 			} else {
-				ptrpos++;
+				for(int i = 0; i < n; i++)
+					ptrpos += credit[i];
 				ptrsend(pfds[1].fd);
 			}
 		}
 
 		// handle punch
 		else if(pfds[2].revents & POLLIN) {
-			if(read(pfds[2].fd, &c, 1) <= 0) {
+			u8 punched[256];
+			n = read(pfds[2].fd, punched, sizeof(punched));
+			if(n <= 0) {
 				disconnectptp(&pfds[2]);
 				initptp();
 				connectptp(&pfds[2]);
 				continue;
 			}
-			memcpy(ptpbuf+1, ptpbuf, (ptpbuflen-1)*sizeof(*ptpbuf));
-			ptpbuf[0] = c&0377;
-			write(ptpfd, &c, 1);
+			for(int i = 0; i < n; i++) {
+				ptpbuf[ptphead] = punched[i];
+				ptphead = (ptphead+1) % ptpbuflen;
+			}
+			write(ptpfd, punched, n);
 		}
 	}
 }
@@ -17,6 +17,7 @@
 #include <pthread.h>      
 
 #include <SDL.h>
+#include "dpyproto.h"
 //#include <SDL_opengl.h>
 #include "glad/glad.h"
 
@@ -47,6 +48,7 @@ char *argv0;
 
 SDL_Window *window;
 int netfd;
+int dpyversion = 2;
 int dbgflag;
 
 GLuint vbo;
@@ -729,9 +731,9 @@ void*
 readthread(void *args)
 {
 	uint32 cmd;
-	uint32 cmds[128];
+	uint32 cmds[1024];
 	int ncmds;
-	int nbytes;
+	static DpyStream dpy;
 	int i;
 	uint64 time;
 	uint64 frmtime = 33333;
@@ -749,11 +751,10 @@ realtime = realtime_start;
 
 	time = 0;
 	int esc = 0;
+	dpyinit(&dpy, netfd, dpyversion, DPY2_LZ);
 for(;;){
-	nbytes = read(netfd, cmds, sizeof(cmds));
-if(nbytes <= 0) break;
-if((nbytes % 4) != 0) printf("yikes %d\n", nbytes), exit(1);
-	ncmds = nbytes/4;
+	ncmds = dpyread(&dpy, cmds, nelem(cmds));
+if(ncmds < 0) break;
 
 	for(i = 0; i < ncmds; i++) {
 		cmd = cmds[i];
@@ -815,11 +816,24 @@ void
 updatepen(void)
 {
 	uint32 cmd;
-	cmd = 0xFF<<24;
+	int w, h, s, x, y;
+
+	// window to display coordinates, see draw
+	SDL_GetWindowSize(window, &w, &h);
+	s = w < h ? w : h;
+	if(s <= 0)
+		return;
+	x = ((penx - (w-s)/2)*BWIDTH/s - BORDER)*1024/WIDTH;
+	y = ((peny - (h-s)/2)*BHEIGHT/s - BORDER)*1024/HEIGHT;
+	if(x < 0) x = 0;
+	if(x > 1023) x = 1023;
+	if(y < 0) y = 0;
+	if(y > 1023) y = 1023;
+
+	cmd = DPY_PEN<<24;
 	cmd |= pendown << 20;
-// TODO: scaling
-	cmd |= penx << 10;
-	cmd |= 1023-peny;
+	cmd |= x << 10;
+	cmd |= 1023-y;
 	write(netfd, &cmd, 4);
 //	printf("%d %d %d\n", penx, peny, pendown);
 }
@@ -827,7 +841,7 @@ updatepen(void)
 void
 usage(void)
 {
-	fprintf(stderr, "usage: %s [-d] [-p port] [server]\n", argv0);
+	fprintf(stderr, "usage: %s [-d] [-1] [-p port] [server]\n", argv0);
 	exit(0);
 }
 
@@ -847,6 +861,10 @@ main(int argc, char *argv[])
 	case 'd':
 		dbgflag++;
 		break;
+	case '1':
+		// old protocol only
+		dpyversion = 1;
+		break;
 	}ARGEND;
 
 	if(argc > 0)
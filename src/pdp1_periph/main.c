@@ -11,6 +11,7 @@
 #include <sys/types.h>
 
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <unistd.h>     
@@ -25,6 +26,9 @@
 #include "glad/glad.h"
 
 #include <common.h>
+#include <dpyproto.h>
+#include <ptrproto.h>
+#include <tapelib.h>
 
 #include "args.h"
 
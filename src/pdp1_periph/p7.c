@@ -293,9 +293,9 @@ void*
 dispthread(void *args)
 {
 	uint32 cmd;
-	uint32 cmds[128];
+	uint32 cmds[1024];
 	int ncmds;
-	int nbytes;
+	static DpyStream dpy;
 	int i;
 	uint64 time;
 	uint64 frmtime = 33333;
@@ -307,16 +307,15 @@ dispthread(void *args)
 
 	time = 0;
 	int esc = 0;
+	dpyinit(&dpy, dpyfd, 2, DPY2_LZ);
 for(;;){
-	nbytes = read(dpyfd, cmds, sizeof(cmds));
-	if(nbytes <= 0) {
+	ncmds = dpyread(&dpy, cmds, nelem(cmds));
+	if(ncmds < 0) {
 		// This seems to happen when the pdp1 isn't noticing the closed
 		// connection quickly enough. shouldn't be a huge issue in practice
 		fprintf(stderr, "dpy disconnected\n");
 		break;
 	}
-	if((nbytes % 4) != 0) printf("yikes %d\n", nbytes), exit(1);
-	ncmds = nbytes/4;
 
 	for(i = 0; i < ncmds; i++) {
 		cmd = cmds[i];
@@ -1,15 +1,20 @@
 #ifdef UNITY_BUILD
 
-unsigned char *ptrbuf;
+const unsigned char *ptrbuf;
+TapeImage *ptrtape;
+// held while drawing from ptrbuf and while swapping it
+pthread_mutex_t ptrlock = PTHREAD_MUTEX_INITIALIZER;
 //unsigned char ptrbuf[200];
 int ptrbuflen;
 int *ptpbuf;
 //int ptpbuf[200];
 int ptpbuflen;
  
+int ptphead;	// ptpbuf is a ring, this is where the next character goes
 int ptpfd = -1;
  
-int ptrpos;
+int ptrpos;	// confirmed by the emulator
+int ptrsent;	// sent ahead of that
 
 int tapeUpdated;
 
@@ -90,6 +95,7 @@ drawReader(Region *reg)
 	setColor(80, 80, 80, 255);
 	drawRectangle(0.0f, 0.0f, width, height);
 
+	pthread_mutex_lock(&ptrlock);
 	if(ptrbuflen > 0) {
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -118,10 +124,18 @@ drawReader(Region *reg)
 
 		glDisable(GL_BLEND);
 	}
+	pthread_mutex_unlock(&ptrlock);
 
 	clearState();
 }
 
+// i characters back from the punch, -1 if nothing punched there
+int
+ptpchar(int i)
+{
+	return ptpbuf[(ptphead + ptpbuflen-1 - i) % ptpbuflen];
+}
+
 void
 drawPunch(Region *reg)
 {
@@ -151,7 +165,7 @@ drawPunch(Region *reg)
 
 		setColor(255, 255, 176, 255);
 		for(i = 0; i < ptpbuflen; i++)
-			if(ptpbuf[i] < 0)
+			if(ptpchar(i) < 0)
 				break;
 		int x = punchpos - i*space;
 		if(x < 0) x = 0;
@@ -161,7 +175,7 @@ drawPunch(Region *reg)
 		i = 0;
 		for(int x = punchpos; x > -2*r; x -= space) {
 			if(i < ptpbuflen)
-				c = ptpbuf[i++];
+				c = ptpchar(i++);
 			else
 				c = -1;
 			if(c < 0)
@@ -187,43 +201,49 @@ drawPunch(Region *reg)
 void
 mountptr(const char *file)
 {
-	FILE *f = fopen(file, "rb");
-	if(f == nil) {
+	TapeImage *t = tapeopen(file);
+	if(t == nil) {
 		fprintf(stderr, "couldn't open file %s\n", file);
 		return;
 	}
-	fseek(f, 0, 2);
-	ptrbuflen = ftell(f);
-	fseek(f, 0, 0);
-	ptrbuf = malloc(ptrbuflen);
-	fread(ptrbuf, 1, ptrbuflen, f);
-	fclose(f);
-
-	ptrpos = 0;
-	// find beginning
-	while(ptrpos < ptrbuflen && ptrbuf[ptrpos] == 0)
-		ptrpos++;
+	pthread_mutex_lock(&ptrlock);
+	ptrtape = t;
+	ptrbuf = t->p;
+	ptrbuflen = t->n;
+	pthread_mutex_unlock(&ptrlock);
+
+	// start a bit before the leader ends
+	ptrpos = t->leader;
 	if(ptrpos > 20) ptrpos -= 10;
 }
 
 void
 unmountptr(void)
 {
-	// i'm lazy...try to mitigate race somewhat
-	static char unsigned dummy[100], *p;
+	// tapeclose may free the image, make sure
+	// the drawing code is done with it first
+	static const unsigned char dummy[100];
+	pthread_mutex_lock(&ptrlock);
 	ptrbuflen = 0;
-	p = ptrbuf;
 	ptrbuf = dummy;
-	if(p != dummy)
-		free(p);
+	pthread_mutex_unlock(&ptrlock);
+	tapeclose(ptrtape);
+	ptrtape = nil;
 }
 
+// keep PTR_WINDOW bytes ahead of what the emulator confirmed
 void
 ptrsend(int fd)
 {
-	char c;
-	c = ptrbuf[ptrpos];
-	write(fd, &c, 1);
+	int n;
+
+	n = ptrpos + PTR_WINDOW - ptrsent;
+	if(n > ptrbuflen - ptrsent)
+		n = ptrbuflen - ptrsent;
+	if(n > 0) {
+		write(fd, ptrbuf+ptrsent, n);
+		ptrsent += n;
+	}
 }
 
 void
@@ -242,7 +262,10 @@ connectptr(struct pollfd *pfd)
 		pfd->events = 0;
 		unmountptr();
 	} else {
+		u8 hello[2] = { PTR_HELLO, PTR_VERSION };
 		pfd->events = POLLIN;
+		write(pfd->fd, hello, 2);
+		ptrsent = ptrpos;
 		ptrsend(pfd->fd);
 	}
 }
@@ -260,13 +283,13 @@ initptp(void)
 	}
 	for(int i = 0; i < ptpbuflen; i++)
 		ptpbuf[i] = -1;
+	ptphead = 0;
 }
 
 void
 fileptp(const char *file)
 {
 	int fd;
-	char c;
 
 	fd = open(file, O_CREAT|O_WRONLY|O_TRUNC, 0644);
 	if(fd < 0) {
@@ -275,8 +298,9 @@ fileptp(const char *file)
 	}
 	close(ptpfd);
 	ptpfd = open("/tmp/ptpunch", O_RDONLY);
-	while(read(ptpfd, &c, 1) > 0)
-		write(fd, &c, 1);
+	// the kernel copies, no need to bring it through here
+	while(sendfile(fd, ptpfd, nil, 1<<20) > 0)
+		;
 	close(fd);
 	close(ptpfd);
 	initptp();
@@ -337,7 +361,6 @@ cli(char *line, int n)
 void*
 tapethread(void *arg)
 {
-	char c;
 	memset(pfds, 0, sizeof(pfds));
 
 	pfds[0].fd = clifd[0];
@@ -402,11 +425,14 @@ tapethread(void *arg)
 
 		// handle reader
 		else if(pfds[1].revents & POLLIN) {
-			if(read(pfds[1].fd, &c, 1) <= 0) {
+			u8 credit[256];
+			n = read(pfds[1].fd, credit, sizeof(credit));
+			if(n <= 0) {
 				disconnectptr(&pfds[1]);
 				unmountptr();
 			} else {
-				ptrpos++;
+				for(int i = 0; i < n; i++)
+					ptrpos += credit[i];
 				ptrsend(pfds[1].fd);
 			}
 			tapeUpdated = 1;
@@ -414,15 +440,19 @@ tapethread(void *arg)
 
 		// handle punch
 		else if(pfds[2].revents & POLLIN) {
-			if(read(pfds[2].fd, &c, 1) <= 0) {
+			u8 punched[256];
+			n = read(pfds[2].fd, punched, sizeof(punched));
+			if(n <= 0) {
 				disconnectptp(&pfds[2]);
 				initptp();
 				connectptp(&pfds[2]);
 				continue;
 			}
-			memcpy(ptpbuf+1, ptpbuf, (ptpbuflen-1)*sizeof(*ptpbuf));
-			ptpbuf[0] = c&0377;
-			write(ptpfd, &c, 1);
+			for(int i = 0; i < n; i++) {
+				ptpbuf[ptphead] = punched[i];
+				ptphead = (ptphead+1) % ptpbuflen;
+			}
+			write(ptpfd, punched, n);
 			tapeUpdated = 1;
 		}
 	}
@@ -0,0 +1,335 @@
+package main
+
+// Display protocol, see src/blincolnlights/dpyproto.h.
+// The browser always gets v1 words, v2 is only spoken on the wire.
+
+import (
+	"bufio"
+	"encoding/binary"
+	"errors"
+	"io"
+	"net"
+	"time"
+)
+
+const (
+	dpyMagic  = 0xD2
+	dpyHdrSz  = 6
+	dpyLZ     = 1
+	dpyMaxCmd = 1024
+	// the emulator sends nothing while nothing is displayed,
+	// after this long we age the display ourselves
+	dpyIdle = 33 * time.Millisecond
+)
+
+var errDpyProto = errors.New("display protocol error")
+
+func dpyHello(version, flags uint32) uint32 {
+	return 0xFE<<24 | flags<<8 | version
+}
+
+func dpyIsSwitch(w uint32) bool {
+	return w&^0xFFFF == 511<<23|1<<22
+}
+
+type dpyStream struct {
+	conn  net.Conn
+	r     *bufio.Reader
+	proto int
+	esc   bool
+	buf   []byte
+	raw   []byte
+
+	tesc   bool
+	credit uint32 // us aged locally, not yet seen in the stream
+	then   time.Time
+}
+
+// newDpyStream asks the emulator for v2 with compression.
+// an old emulator ignores the hello and keeps sending v1.
+func newDpyStream(conn net.Conn) (*dpyStream, error) {
+	var hello [4]byte
+	binary.LittleEndian.PutUint32(hello[:], dpyHello(2, dpyLZ))
+	if _, err := conn.Write(hello[:]); err != nil {
+		return nil, err
+	}
+	return &dpyStream{
+		conn:  conn,
+		then:  time.Now(),
+		r:     bufio.NewReaderSize(conn, 64*1024),
+		proto: 1,
+		buf:   make([]byte, 64*1024),
+		raw:   make([]byte, 64*1024),
+	}, nil
+}
+
+// read returns the next batch of display commands as v1 words
+func (s *dpyStream) read(cmds []uint32) (int, error) {
+	if s.r.Buffered() == 0 && !s.esc {
+		s.conn.SetReadDeadline(time.Now().Add(dpyIdle))
+		_, err := s.r.Peek(1)
+		s.conn.SetReadDeadline(time.Time{})
+		if ne, ok := err.(net.Error); ok && ne.Timeout() {
+			// nothing displayed, age locally
+			t := time.Now()
+			dt := uint32(t.Sub(s.then) / time.Microsecond)
+			s.then = t
+			s.credit += dt
+			cmds[0] = 511 << 23
+			cmds[1] = dt
+			return 2, nil
+		}
+		if err != nil {
+			return 0, err
+		}
+	}
+	n, err := s.readBlock(cmds)
+	if n > 0 {
+		s.settle(cmds[:n])
+	}
+	return n, err
+}
+
+// take time we already aged locally out of what the emulator sends
+func (s *dpyStream) settle(cmds []uint32) {
+	s.then = time.Now()
+	for i, c := range cmds {
+		if s.tesc {
+			s.tesc = false
+			d := minU32(c, s.credit)
+			cmds[i] -= d
+			s.credit -= d
+		} else if c>>23 == 511 {
+			s.tesc = true
+		} else if s.credit > 0 {
+			d := minU32(c>>23, s.credit)
+			cmds[i] -= d << 23
+			s.credit -= d
+		}
+	}
+}
+
+func minU32(a, b uint32) uint32 {
+	if a < b {
+		return a
+	}
+	return b
+}
+
+func (s *dpyStream) readBlock(cmds []uint32) (int, error) {
+	for {
+		if s.proto == 1 {
+			n, sw, err := s.readV1(cmds)
+			if err != nil || n > 0 || !sw {
+				return n, err
+			}
+			continue
+		}
+		n, err := s.readV2(cmds)
+		if err != nil || n > 0 {
+			return n, err
+		}
+	}
+}
+
+func (s *dpyStream) readV1(cmds []uint32) (int, bool, error) {
+	var w [4]byte
+	n := 0
+	for n < len(cmds) && (n == 0 || s.r.Buffered() >= 4) {
+		if _, err := io.ReadFull(s.r, w[:]); err != nil {
+			return n, false, err
+		}
+		cmd := binary.LittleEndian.Uint32(w[:])
+		if !s.esc && dpyIsSwitch(cmd) {
+			s.proto = int(cmd & 0xFF)
+			return n, true, nil
+		}
+		s.esc = !s.esc && cmd>>23 == 511
+		cmds[n] = cmd
+		n++
+	}
+	return n, false, nil
+}
+
+func (s *dpyStream) readV2(cmds []uint32) (int, error) {
+	var hdr [dpyHdrSz]byte
+	if _, err := io.ReadFull(s.r, hdr[:]); err != nil {
+		return 0, err
+	}
+	if hdr[0] != dpyMagic {
+		return 0, errDpyProto
+	}
+	l := int(binary.LittleEndian.Uint16(hdr[2:]))
+	rawlen := int(binary.LittleEndian.Uint16(hdr[4:]))
+	payload := s.buf[:l]
+	if _, err := io.ReadFull(s.r, payload); err != nil {
+		return 0, err
+	}
+	if hdr[1]&dpyLZ != 0 {
+		n, err := lzDecompress(payload, s.raw)
+		if err != nil || n != rawlen {
+			return 0, errDpyProto
+		}
+		payload = s.raw[:n]
+	}
+	return dpy2Decode(payload, cmds)
+}
+
+func dpy2Decode(p []byte, cmds []uint32) (int, error) {
+	var x, y, in, dt uint32
+	n := 0
+	i := 0
+	get := func() (uint32, error) {
+		if i >= len(p) {
+			return 0, errDpyProto
+		}
+		i++
+		return uint32(p[i-1]), nil
+	}
+	coord := func(mode byte, v *uint32) error {
+		switch mode {
+		case 0:
+		case 1:
+			c, err := get()
+			if err != nil {
+				return err
+			}
+			*v = uint32(int32(*v)+int32(int8(c))) & 01777
+		case 2:
+			lo, err := get()
+			if err != nil {
+				return err
+			}
+			hi, err := get()
+			if err != nil {
+				return err
+			}
+			*v = (lo | hi<<8) & 01777
+		default:
+			return errDpyProto
+		}
+		return nil
+	}
+	for i < len(p) {
+		tag := p[i]
+		i++
+		if tag&0x80 != 0 {
+			var v uint32
+			for shift := 0; ; shift += 7 {
+				c, err := get()
+				if err != nil {
+					return n, err
+				}
+				v |= (c & 0x7F) << shift
+				if c&0x80 == 0 {
+					break
+				}
+			}
+			if n+2 > len(cmds) {
+				return n, errDpyProto
+			}
+			cmds[n] = 511 << 23
+			cmds[n+1] = v
+			n += 2
+			continue
+		}
+		if err := coord(tag&3, &x); err != nil {
+			return n, err
+		}
+		if err := coord(tag>>2&3, &y); err != nil {
+			return n, err
+		}
+		if tag&020 != 0 {
+			c, err := get()
+			if err != nil {
+				return n, err
+			}
+			in = c & 7
+		}
+		if tag&040 != 0 {
+			c, err := get()
+			if err != nil {
+				return n, err
+			}
+			dt = c
+		} else if tag&0100 != 0 {
+			lo, err := get()
+			if err != nil {
+				return n, err
+			}
+			hi, err := get()
+			if err != nil {
+				return n, err
+			}
+			dt = lo | hi<<8
+		}
+		if n >= len(cmds) {
+			return n, errDpyProto
+		}
+		cmds[n] = x | y<<10 | in<<20 | dt<<23
+		n++
+	}
+	return n, nil
+}
+
+// LZ4-style block, see lzdecompress in dpyproto.c
+func lzDecompress(src, dst []byte) (int, error) {
+	ip, op := 0, 0
+	getlen := func(l int) (int, error) {
+		for {
+			if ip >= len(src) {
+				return 0, errDpyProto
+			}
+			c := int(src[ip])
+			ip++
+			l += c
+			if c != 255 {
+				return l, nil
+			}
+		}
+	}
+	for ip < len(src) {
+		tok := int(src[ip])
+		ip++
+		lit := tok >> 4
+		var err error
+		if lit == 15 {
+			if lit, err = getlen(lit); err != nil {
+				return 0, err
+			}
+		}
+		if lit > len(src)-ip || lit > len(dst)-op {
+			return 0, errDpyProto
+		}
+		copy(dst[op:], src[ip:ip+lit])
+		op += lit
+		ip += lit
+		if ip >= len(src) {
+			break
+		}
+
+		if len(src)-ip < 2 {
+			return 0, errDpyProto
+		}
+		off := int(src[ip]) | int(src[ip+1])<<8
+		ip += 2
+		if off == 0 || off > op {
+			return 0, errDpyProto
+		}
+		mlen := tok&15 + 4
+		if tok&15 == 15 {
+			if mlen, err = getlen(mlen); err != nil {
+				return 0, err
+			}
+		}
+		if mlen > len(dst)-op {
+			return 0, errDpyProto
+		}
+		// may overlap
+		for ; mlen > 0; mlen-- {
+			dst[op] = dst[op-off]
+			op++
+		}
+	}
+	return op, nil
+}
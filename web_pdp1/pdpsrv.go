@@ -2,7 +2,6 @@ package main
 
 import (
 	"bufio"
-	"encoding/binary"
 	"encoding/json"
 	"fmt"
 	"io"
@@ -139,27 +138,47 @@ func (s *PeriphServer) emuCommand(cmd string) (string, error) {
 	return strings.TrimSpace(response), nil
 }
 
+// Reader protocol v2, see src/blincolnlights/ptrproto.h
+const (
+	ptrHello   = 0376
+	ptrVersion = 2
+	ptrWindow  = 256
+)
+
+// readLoop streams the tape ahead of the emulator and moves the
+// position as the emulator confirms what it has read.
 func (s *PeriphServer) readLoop(conn net.Conn, data []byte, startPos int) {
 	defer conn.Close()
 
 	pos := startPos
-	buf := make([]byte, 1)
+	sent := startPos
+	credit := make([]byte, 256)
 
+	if _, err := conn.Write([]byte{ptrHello, ptrVersion}); err != nil {
+		log.Printf("Error writing to reader: %v", err)
+		return
+	}
 	for pos < len(data) {
-		buf[0] = data[pos]
-		pos++
-
-		_, err := conn.Write(buf)
-		if err != nil {
-			log.Printf("Error writing to reader: %v", err)
-			return
+		end := pos + ptrWindow
+		if end > len(data) {
+			end = len(data)
+		}
+		if sent < end {
+			if _, err := conn.Write(data[sent:end]); err != nil {
+				log.Printf("Error writing to reader: %v", err)
+				return
+			}
+			sent = end
 		}
 
-		_, err = conn.Read(buf)
+		n, err := conn.Read(credit)
 		if err != nil {
 			log.Printf("Error reading from reader: %v", err)
 			return
 		}
+		for _, c := range credit[:n] {
+			pos += int(c)
+		}
 
 		s.sendToWeb(Message{
 			Type:     "reader_position",
@@ -244,20 +263,21 @@ func (s *PeriphServer) handlePunch() {
 func (s *PeriphServer) displayCon(conn net.Conn) {
 	defer conn.Close()
 
-	buf := make([]byte, 128*4)
-	cmds := make([]uint32, 128)
+	dpy, err := newDpyStream(conn)
+	if err != nil {
+		log.Printf("display: write error: %v\n", err)
+		s.sendToWeb(Message{Type: "dpy_disconnected"})
+		return
+	}
+	cmds := make([]uint32, dpyMaxCmd)
 	for {
-		n, err := conn.Read(buf)
+		ncmds, err := dpy.read(cmds)
 		if err != nil {
 			log.Printf("display: read error: %v\n", err)
 			s.sendToWeb(Message{Type: "dpy_disconnected"})
 			return
 		}
 
-		ncmds := n / 4
-		for i := 0; i < ncmds; i++ {
-			cmds[i] = uint32(binary.LittleEndian.Uint32(buf[i*4 : (i+1)*4]))
-		}
 		s.sendToWeb(Message{
 			Type:   "points",
 			Points: cmds[:ncmds],